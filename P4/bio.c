@@ -7,11 +7,16 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+//     breadn gets buffers for a run of consecutive blocks,
+//     reading the uncached ones with as few disk requests as possible.
+//     bread_shared and breadn_shared lock the buffers shared,
+//     for callers that will not modify them.
 // * After changing buffer data, call bwrite to write it to disk.
+//     bwriten writes several buffers in one go.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
-// * Only one process at a time can use a buffer,
-//     so do not keep them longer than necessary.
+// * Only one process at a time can use a buffer, or any number
+//     sharing it to read, so do not keep them longer than necessary.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
@@ -50,27 +55,26 @@ binit(void)
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
+    b->data = b->mem;
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
 }
 
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// If not found, allocate a buffer, but only if more than
+// reserve unused buffers remain.  Return the buffer, referenced
+// but not locked, or 0.  Caller must hold bcache.lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(uint dev, uint blockno, int reserve)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct buf *b, *empty;
+  int nfree;
 
   // Is the block already cached?
   for(b = bcache.head.next; b != &bcache.head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
@@ -78,18 +82,42 @@ bget(uint dev, uint blockno)
   // Not cached; recycle an unused buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
+  empty = 0;
+  nfree = 0;
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if(empty == 0)
+        empty = b;
+      if(++nfree > reserve)
+        break;
     }
   }
-  panic("bget: no buffers");
+  if(nfree <= reserve)
+    return 0;
+  b = empty;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->data = b->mem;  // the RAM disk may have pointed it elsewhere
+  b->refcnt = 1;
+  return b;
+}
+
+static int bfindn(uint, uint, struct buf**, int);
+
+// Return locked buffer for block on device dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  b = bfind(dev, blockno, 0);
+  release(&bcache.lock);
+  if(b == 0)
+    panic("bget: no buffers");
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +133,105 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for a block the caller will overwrite
+// entirely, without reading it from disk.  The buf is marked
+// valid; its contents are the block's if it was cached, and
+// anything otherwise.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Lock bufs bs[0..n) and read the ones not yet valid in one
+// go.  If shared, the bufs end up locked shared; a buf that
+// must be read is locked exclusively for the read and then
+// downgraded.
+static void
+lockbufs(struct buf **bs, int n, int shared)
+{
+  struct buf *rd[NBATCH];
+  int i, nrd;
+
+  nrd = 0;
+  for(i = 0; i < n; i++){
+    if(shared){
+      acquiresleepshared(&bs[i]->lock);
+      if(bs[i]->flags & B_VALID)
+        continue;
+      releasesleep(&bs[i]->lock);
+    }
+    acquiresleep(&bs[i]->lock);
+    if((bs[i]->flags & B_VALID) == 0)
+      rd[nrd++] = bs[i];
+    else if(shared)
+      downgradesleep(&bs[i]->lock);
+  }
+  iderwv(rd, nrd);
+  if(shared)
+    for(i = 0; i < nrd; i++)
+      downgradesleep(&rd[i]->lock);
+}
+
+// Like bread, but the buf is locked shared with other
+// readers, so it must not be modified.  For callers that
+// only look, such as readi, dirlookup and ilock.
+struct buf*
+bread_shared(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  bfindn(dev, blockno, &b, 1);
+  lockbufs(&b, 1, 1);
+  return b;
+}
+
+// Find bufs for up to n consecutive blocks; see breadn.
+static int
+bfindn(uint dev, uint blockno, struct buf **bs, int n)
+{
+  int i;
+
+  if(n > NBATCH)
+    n = NBATCH;
+  acquire(&bcache.lock);
+  for(i = 0; i < n; i++){
+    if((bs[i] = bfind(dev, blockno+i, i == 0 ? 0 : NBATCH)) == 0)
+      break;
+  }
+  release(&bcache.lock);
+  if(i == 0)
+    panic("bget: no buffers");
+  return i;
+}
+
+// Return locked bufs in bs[] for up to n consecutive blocks
+// starting at blockno.  Blocks not yet cached are read together,
+// so a run of them costs one disk request.  To leave buffers
+// for others, fewer than n bufs (but always at least one) are
+// returned when the cache is short of unused buffers.
+// Returns the number of bufs.
+int
+breadn(uint dev, uint blockno, struct buf **bs, int n)
+{
+  n = bfindn(dev, blockno, bs, n);
+  lockbufs(bs, n, 0);
+  return n;
+}
+
+// breadn with the bufs locked shared, as in bread_shared.
+int
+breadn_shared(uint dev, uint blockno, struct buf **bs, int n)
+{
+  n = bfindn(dev, blockno, bs, n);
+  lockbufs(bs, n, 1);
+  return n;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,12 +242,27 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
-// Release a locked buffer.
+// Write the n locked bufs in bs to disk.  Bufs for
+// consecutive blocks go to the disk in one request.
+void
+bwriten(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwrite");
+    bs[i]->flags |= B_DIRTY;
+  }
+  iderwv(bs, n);
+}
+
+// Release a locked buffer, held exclusively or shared.
 // Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
+  if(!holdingsleep(&b->lock) && !holdingsleepshared(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
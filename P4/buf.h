@@ -7,7 +7,9 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qstamp;       // when queued, for iostat
+  uchar *data;       // block contents; mem, or the disk's own copy
+  uchar mem[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
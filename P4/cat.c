@@ -9,8 +9,16 @@ cat(int fd)
 {
   int n;
 
+  // If either end is a pipe, the kernel can move the data
+  // without copying it through buf.
+  if(bufflush(1) == 0){
+    while((n = splice(fd, 1, 64*1024)) > 0)
+      ;
+    if(n == 0)
+      return;
+  }
   while((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (write(1, buf, n) != n) {
+    if (bufwrite(1, buf, n) != n) {
       printf(1, "cat: write error\n");
       exit();
     }
@@ -31,6 +39,8 @@ main(int argc, char *argv[])
     exit();
   }
 
+  // Files need no echo as they go; exit() flushes the rest.
+  bufmode(1, BUF_FULL);
   for(i = 1; i < argc; i++){
     if((fd = open(argv[i], 0)) < 0){
       printf(1, "cat: cannot open %s\n", argv[i]);
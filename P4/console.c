@@ -14,6 +14,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
 
 static void consputc(int);
 
@@ -191,7 +192,7 @@ struct {
 void
 consoleintr(int (*getc)(void))
 {
-  int c, doprocdump = 0;
+  int c, doprocdump = 0, dopoll = 0;
 #ifdef CS333_P3
   int doreadydump = 0;
   int dofreedump = 0;
@@ -240,12 +241,15 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          dopoll = 1;
         }
       }
       break;
     }
   }
   release(&cons.lock);
+  if(dopoll)
+    pollwakeup();  // after cons.lock, as consolepoll takes it
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
   }
@@ -318,6 +322,19 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+int
+consolepoll(struct inode *ip)
+{
+  int r;
+
+  r = POLLOUT;
+  acquire(&cons.lock);
+  if(input.r != input.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -325,6 +342,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
@@ -2,6 +2,8 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct iostat;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,14 +11,21 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct tracerec;
+struct trapframe;
 #ifdef CS333_P2
 struct uproc;
 #endif // CS333_P2
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_shared(uint, uint);
+struct buf*     bnew(uint, uint);
+int             breadn(uint, uint, struct buf**, int);
+int             breadn_shared(uint, uint, struct buf**, int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwriten(struct buf**, int);
 
 // console.c
 void            consoleinit(void);
@@ -32,18 +41,33 @@ struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+int             filelseek(struct file*, int, int);
+int             filepoll(struct file*);
+int             filepread(struct file*, char*, int, uint);
+int             filepwrite(struct file*, char*, int, uint);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             fileprealloc(struct file*, uint, uint);
+int             filesplice(struct file*, struct file*, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
+uint            pollenter(int);
+void            pollexit(int);
+void            polltick(void);
+void            pollwait(uint*);
+void            pollwakeup(void);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dcforget(struct inode*, char*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+int             iprealloc(struct inode*, uint, uint);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -51,6 +75,8 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+int             opblocks(int, int);
+int             pathlen(char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
@@ -60,6 +86,8 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
+int             idestat(int, struct iostat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -86,9 +114,13 @@ void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
+int             inlog(uint);
 void            log_write(struct buf*);
+void            log_freed(uint);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+int             log_maxop(void);
 
 // mp.c
 extern int      ismp;
@@ -101,8 +133,15 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipegetsize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+int             pipepoll(struct pipe*, int);
+int             pipereserve(struct pipe*, char**, int);
+void            pipecommit(struct pipe*, int);
+int             pipepeek(struct pipe*, char**, int);
+void            pipeconsume(struct pipe*, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -119,6 +158,9 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+int             trace(uint*);
+void            tracelog(struct tracerec*);
+int             traceread(int, struct tracerec*, int);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -151,8 +193,11 @@ void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            downgradesleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             holdingsleepshared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -177,6 +222,7 @@ void            timerinit(void);
 
 // trap.c
 void            idtinit(void);
+void            systrap(struct trapframe*);
 extern uint     ticks;
 void            tvinit(void);
 
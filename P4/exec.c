@@ -20,7 +20,7 @@ exec(char *path, char **argv)
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
-  begin_op();
+  begin_opn(opblocks(pathlen(path)+1, 0));
 
   if((ip = namei(path)) == 0){
     end_op();
@@ -102,6 +102,7 @@ exec(char *path, char **argv)
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
+  curproc->ioring = 0;
   switchuvm(curproc);
   freevm(oldpgdir);
   return 0;
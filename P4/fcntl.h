@@ -2,3 +2,19 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x400  // reads and writes fail rather than wait
+
+// Returned, negated, by reads and writes that would have to
+// wait on an O_NONBLOCK fd.
+#define EAGAIN    2
+
+// lseek() whence
+#define SEEK_SET  0  // offset from start of file
+#define SEEK_CUR  1  // offset from current position
+#define SEEK_END  2  // offset from end of file
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer to hold arg bytes
+#define F_GETFL      3  // open mode and flags
+#define F_SETFL      4  // set flags (only O_NONBLOCK) to arg
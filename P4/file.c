@@ -5,10 +5,67 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
+#include "fcntl.h"
+#include "poll.h"
+
+// Log blocks a transaction needs to write nb blocks of a file:
+// the i-node, the allocation bitmap blocks the new blocks can
+// span, and the indirect blocks at each of three levels, plus
+// the data itself unless it is written in place.
+static int
+writeblocks(int nb)
+{
+  int n = 1 + (nb/BPB + 2) + (nb/NINDIRECT + 6);
+#ifndef ORDERED_DATA
+  n += nb;
+#endif
+  return n;
+}
+
+// Bytes of file that filewrite() and fileprealloc() handle per
+// transaction, sized so that the blocks a chunk can touch,
+// including a partial block at either end, fit the largest
+// reservation the log allows.
+static uint
+writemax(void)
+{
+  static uint max;
+  int nb;
+
+  if(max == 0){
+    for(nb = 1; writeblocks(nb+1 + 2) <= log_maxop(); nb++)
+      ;
+    max = nb * BSIZE;
+  }
+  return max;
+}
+
+// Log blocks to reserve for a chunk of n bytes at off.
+static int
+chunkblocks(uint off, uint n)
+{
+  if(n == 0)
+    return writeblocks(0);
+  return writeblocks((off + n - 1)/BSIZE - off/BSIZE + 1);
+}
+
+// Processes in poll() sleep on pollq.seq.  Anything that may
+// make a file ready calls pollwakeup(), which bumps seq so that
+// a poller that was about to sleep looks again.
+struct {
+  struct spinlock lock;
+  uint seq;
+  int npoll;   // processes in poll()
+  int ntimed;  // those of them with a timeout
+} pollq;
 
 struct devsw devsw[NDEV];
 struct {
@@ -20,6 +77,7 @@ void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&pollq.lock, "poll");
 }
 
 // Allocate a file structure.
@@ -73,7 +131,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
-    begin_op();
+    begin_opn(opblocks(1, 0));
     iput(ff.ip);
     end_op();
   }
@@ -92,66 +150,416 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Read n bytes of f's inode at *off, advancing *off.
+static int
+fileread1(struct file *f, char *addr, int n, uint *off)
+{
+  int r;
+
+  ilock(f->ip);
+  if((r = readi(f->ip, addr, *off, n)) > 0)
+    *off += r;
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
+    // A device with nothing to read would wait.
+    if(f->nonblock && f->ip->type == T_DEV && !(filepoll(f) & POLLIN))
+      return -EAGAIN;
+    return fileread1(f, addr, n, &f->off);
+  }
+  panic("fileread");
+}
+
+// Write n bytes to f's inode at *off, advancing *off.
+static int
+filewrite1(struct file *f, char *addr, int n, uint *off)
+{
+  int r;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size; see writemax().
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = writemax();
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_opn(chunkblocks(*off, n1));
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    if ((r = writei(f->ip, addr + i, *off, n1)) > 0)
+      *off += r;
     iunlock(f->ip);
-    return r;
+    end_op();
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
   }
-  panic("fileread");
+  return i == n ? n : -1;
 }
 
 //PAGEBREAK!
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
+{
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipewrite(f->pipe, addr, n, f->nonblock);
+  if(f->type == FD_INODE)
+    return filewrite1(f, addr, n, &f->off);
+  panic("filewrite");
+}
+
+// Reserve disk blocks for bytes [off, off+n) of file f,
+// growing the file if needed.
+int
+fileprealloc(struct file *f, uint off, uint n)
 {
   int r;
 
-  if(f->writable == 0)
+  if(f->writable == 0 || f->type != FD_INODE)
     return -1;
+
+  // allocate a few blocks at a time to stay within
+  // the maximum log transaction size, as in filewrite.
+  uint max = writemax();
+  uint i = 0;
+  while(i < n){
+    uint n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_opn(chunkblocks(off + i, n1));
+    ilock(f->ip);
+    r = iprealloc(f->ip, off + i, n1);
+    iunlock(f->ip);
+    end_op();
+
+    if(r < 0)
+      return -1;
+    i += n1;
+  }
+  return 0;
+}
+
+// Read n bytes at offset off, leaving f's offset alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  return fileread1(f, addr, n, &off);
+}
+
+// Write n bytes at offset off, leaving f's offset alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return filewrite1(f, addr, n, &off);
+}
+
+// Set f's offset to off relative to whence (SEEK_SET, SEEK_CUR
+// or SEEK_END).  The offset may not go past the end of the
+// file, since writei() cannot leave a hole.  Returns the new
+// offset.
+int
+filelseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else
+    base = -1;
+  if(base < 0 || base + off < 0 || base + off > f->ip->size){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
+// Return which of POLLIN, POLLOUT and POLLHUP hold for f now.
+int
+filepoll(struct file *f)
+{
+  int r;
+
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
+    return pipepoll(f->pipe, f->writable);
+  if(f->type == FD_INODE && f->ip->type == T_DEV){
+    if(f->ip->major < 0 || f->ip->major >= NDEV ||
+       !devsw[f->ip->major].poll)
+      return POLLIN|POLLOUT;
+    r = devsw[f->ip->major].poll(f->ip);
+  } else
+    r = POLLIN|POLLOUT;  // files never block
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
+// Start a poll(); timed if it has a timeout.  Returns the
+// wakeup sequence number to pass to pollwait().
+uint
+pollenter(int timed)
+{
+  uint seq;
+
+  acquire(&pollq.lock);
+  pollq.npoll++;
+  if(timed)
+    pollq.ntimed++;
+  seq = pollq.seq;
+  release(&pollq.lock);
+  return seq;
+}
+
+// Sleep unless there has been a pollwakeup() since *seq was
+// taken, then update *seq.
+void
+pollwait(uint *seq)
+{
+  acquire(&pollq.lock);
+  if(*seq == pollq.seq)
+    sleep(&pollq.seq, &pollq.lock);
+  *seq = pollq.seq;
+  release(&pollq.lock);
+}
+
+void
+pollexit(int timed)
+{
+  acquire(&pollq.lock);
+  pollq.npoll--;
+  if(timed)
+    pollq.ntimed--;
+  release(&pollq.lock);
+}
+
+// Wake processes in poll() to look at their files again.
+// Call without holding the lock of the changed object.
+void
+pollwakeup(void)
+{
+  if(pollq.npoll == 0)
+    return;
+  acquire(&pollq.lock);
+  pollq.seq++;
+  wakeup(&pollq.seq);
+  release(&pollq.lock);
+}
+
+// Called on each clock tick, so timed polls can time out.
+void
+polltick(void)
+{
+  if(pollq.ntimed)
+    pollwakeup();
+}
+
+// Read into the n segments of iov in turn, stopping at the
+// first short read.  An inode is locked once for the whole call.
+int
+filereadv(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type != FD_INODE){
+    for(tot = i = 0; i < n; i++){
+      if((r = fileread(f, iov[i].iov_base, iov[i].iov_len)) < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r < iov[i].iov_len)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
     }
-    return i == n ? n : -1;
+    return tot;
   }
-  panic("filewrite");
+  r = 0;
+  ilock(f->ip);
+  for(tot = i = 0; i < n; i++){
+    if((r = readi(f->ip, iov[i].iov_base, f->off, iov[i].iov_len)) < 0)
+      break;
+    f->off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
+}
+
+// Write the n segments of iov in turn.  If they fit in one
+// transaction, an inode is locked once and the log used once;
+// otherwise each segment goes to filewrite() on its own.
+int
+filewritev(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < n; i++)
+    tot += iov[i].iov_len;
+  if(f->type != FD_INODE || tot > writemax()){
+    for(tot = i = 0; i < n; i++){
+      if((r = filewrite(f, iov[i].iov_base, iov[i].iov_len)) < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+  if(tot == 0)
+    return 0;
+
+  begin_opn(chunkblocks(f->off, tot));
+  ilock(f->ip);
+  for(tot = i = 0; i < n; i++){
+    if((r = writei(f->ip, iov[i].iov_base, f->off, iov[i].iov_len)) < 0)
+      break;
+    if(r != iov[i].iov_len)
+      panic("short filewritev");
+    f->off += r;
+    tot += r;
+  }
+  iunlock(f->ip);
+  end_op();
+  if(i < n && tot == 0)
+    return -1;
+  return tot;
 }
 
+// Move up to n bytes from fin to fout, as much as can go
+// now without waiting.  Returns the number moved, 0 at end of
+// input, -EAGAIN if one side is not ready, or -1.
+static int
+splicestep(struct file *fin, struct file *fout, int n)
+{
+  char *src, *dst;
+  int m, r;
+
+  if(fin->type == FD_PIPE){
+    if((m = pipepeek(fin->pipe, &src, n)) <= 0)
+      return m;
+    if(fout->type == FD_PIPE){
+      if((r = pipereserve(fout->pipe, &dst, m)) > 0){
+        memmove(dst, src, r);  // ring to ring
+        pipecommit(fout->pipe, r);
+      }
+    } else
+      r = filewrite(fout, src, m);
+    pipeconsume(fin->pipe, r > 0 ? r : 0);
+    return r;
+  }
+
+  // Into a pipe from an inode.  A device may have nothing to
+  // read, and the space must not stay reserved while it waits.
+  if(!(filepoll(fin) & POLLIN))
+    return -EAGAIN;
+  if((r = pipereserve(fout->pipe, &dst, n)) < 0)
+    return r;
+  r = fileread(fin, dst, r);
+  pipecommit(fout->pipe, r > 0 ? r : 0);
+  return r;
+}
+
+// Wait, holding nothing, until fin has input (or end of file)
+// and fout has room (or no reader).  Returns 0, or -EAGAIN
+// if the side not ready is non-blocking, or -1 if killed.
+static int
+splicewait(struct file *fin, struct file *fout)
+{
+  uint seq;
+  int in, out, r;
+
+  seq = pollenter(0);
+  for(;;){
+    in = filepoll(fin) & (POLLIN|POLLHUP);
+    out = filepoll(fout) & (POLLOUT|POLLHUP);
+    if(in && out){
+      r = 0;
+      break;
+    }
+    if((!in && fin->nonblock) || (!out && fout->nonblock)){
+      r = -EAGAIN;
+      break;
+    }
+    if(myproc()->killed){
+      r = -1;
+      break;
+    }
+    pollwait(&seq);
+  }
+  pollexit(0);
+  return r;
+}
+
+// Move up to n bytes from fin to fout without passing them
+// through user space; at least one of the two must be a pipe.
+// The bytes go straight between the pipe's ring and the other
+// file (or the other ring), so each is copied once, and only
+// what fout takes leaves fin.  Waits until some bytes can
+// move, like read(), and stops early at end of input or when
+// moving more would mean waiting.  Returns the number of
+// bytes moved, or -1 (or -EAGAIN) if none were.
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  int tot, r;
+
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+  if(fin->type != FD_PIPE && fout->type != FD_PIPE)
+    return -1;
+  if(fin->type == FD_PIPE && fout->type == FD_PIPE && fin->pipe == fout->pipe)
+    return -1;
+
+  r = 0;
+  for(tot = 0; tot < n; ){
+    if((r = splicestep(fin, fout, n - tot)) > 0){
+      tot += r;
+      continue;
+    }
+    if(r != -EAGAIN || tot > 0 || (r = splicewait(fin, fout)) < 0)
+      break;
+  }
+  if(tot == 0 && r < 0)
+    return r;
+  return tot;
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;  // O_NONBLOCK: fail with -EAGAIN rather than wait
   struct pipe *pipe;
   struct inode *ip;
   uint off;
@@ -14,6 +15,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // hash chain
+  struct inode *lruprev; // list of unreferenced inodes
+  struct inode *lrunext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +26,9 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+
+  uint goal;          // where to look for the next free block
 };
 
 // table mapping major device number to
@@ -30,6 +36,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*);  // POLLIN/POLLOUT now ready
 };
 
 extern struct devsw devsw[];
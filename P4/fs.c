@@ -23,6 +23,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(uint, uint);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb;
@@ -33,7 +35,7 @@ readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
+  bp = bread_shared(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
 }
@@ -44,37 +46,121 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// The allocator keeps a count of the free blocks described by
+// each bitmap block, so it can pass over full ones without
+// reading them, and a cursor where the last search ended, so
+// allocations without a goal carry on from there (next fit).
+// nfree[i] changes only while bitmap block i is held locked
+// by bread; read elsewhere it is just a hint.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+struct {
+  uint cursor;
+  int nfree[FSSIZE/BPB + 1];
+} freemap;
+
+// Count the free blocks in each bitmap block.
+static void
+bcountinit(int dev)
 {
-  int b, bi, m;
+  int b, bi;
   struct buf *bp;
 
-  bp = 0;
+  if(sb.size > sizeof(freemap.nfree)/sizeof(freemap.nfree[0])*BPB)
+    panic("bcountinit: disk too big");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    freemap.nfree[b/BPB] = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        freemap.nfree[b/BPB]++;
+    brelse(bp);
+  }
+}
+
+// Return the first zero bit in [lo, hi) of the bitmap map,
+// or -1 if there is none.  Looks a word at a time.
+static int
+bfirstfree(uint *map, int lo, int hi)
+{
+  uint bits;
+  int w, bi;
+
+  for(w = lo/32; w*32 < hi; w++){
+    bits = ~map[w];
+    if(w == lo/32)
+      bits &= ~0U << (lo%32);
+    if(bits){
+      bi = w*32 + __builtin_ctz(bits);
+      return bi < hi ? bi : -1;
+    }
+  }
+  return -1;
+}
+
+// Look for a free block in [from, to) and mark it in use.
+// Unless all is set, skip bitmap blocks that the free counts
+// say are full.  If inplace is set, skip blocks inlog()
+// reports.  Returns 0 if there is none.
+static uint
+bscan(uint dev, uint from, uint to, int all, int inplace)
+{
+  int b, bi, hi;
+  struct buf *bp;
+
+  for(b = from - from%BPB; b < to; b += BPB){
+    if(!all && freemap.nfree[b/BPB] == 0)
+      continue;
+    bp = bread(dev, BBLOCK(b, sb));
+    hi = min(BPB, to - b);
+    bi = bfirstfree((uint*)bp->data, b < from ? from - b : 0, hi);
+    while(inplace && bi >= 0 && inlog(b + bi))
+      bi = bfirstfree((uint*)bp->data, bi + 1, hi);
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      freemap.nfree[b/BPB]--;
+      log_write(bp);
+      brelse(bp);
+      return b + bi;
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  return 0;
+}
+
+// Allocate a zeroed disk block, the first free one at or
+// after goal if there is one.  With no goal, carry on from
+// where the last allocation left off.
+//
+// A block that will be written in place, bypassing the log,
+// must not be one an earlier transaction still has in the log,
+// or a checkpoint or recovery would overwrite it with the old
+// contents.  Nor may it be one freed by a transaction not yet
+// committed, or a crash would leave the old file pointing at
+// the new data.  Such a block is not zeroed either; the caller
+// fills it.
+static uint
+balloc(uint dev, uint goal, int inplace)
+{
+  uint b;
+
+  if(goal == 0 || goal >= sb.size)
+    goal = freemap.cursor;
+  if((b = bscan(dev, goal, sb.size, 0, inplace)) == 0 &&
+     (b = bscan(dev, 0, goal, 0, inplace)) == 0 &&
+     (b = bscan(dev, 0, sb.size, 1, inplace)) == 0)
+    panic("balloc: out of blocks");
+  freemap.cursor = b + 1;
+  if(!inplace)
+    bzero(dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -84,15 +170,120 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
-  readsb(dev, &sb);
   bp = bread(dev, BBLOCK(b, sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  freemap.nfree[b/BPB]++;
   log_write(bp);
   brelse(bp);
+  log_freed(b);
+}
+
+// Inode map.
+//
+// Inode i is in use if bit i of the inode map is set; the map
+// changes in the same transaction as the inode's type.  In
+// memory, inodemap counts the free inodes, so ialloc can fail
+// at once, and keeps a hint where the search for one starts.
+
+struct {
+  struct spinlock lock;
+  int nfree;
+  uint hint;
+} inodemap;
+
+// Count the free inodes.
+static void
+imapinit(int dev)
+{
+  int b, bi;
+  struct buf *bp;
+
+  initlock(&inodemap.lock, "inodemap");
+  inodemap.nfree = 0;
+  inodemap.hint = 1;
+  for(b = 0; b < sb.ninodes; b += BPB){
+    bp = bread(dev, IMBLOCK(b, sb));
+    for(bi = 0; bi < BPB && b + bi < sb.ninodes; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        inodemap.nfree++;
+    brelse(bp);
+  }
+}
+
+// Look for a free inode in [from, to) and mark it in use.
+// Returns 0 if there is none.
+static uint
+imapscan(uint dev, uint from, uint to)
+{
+  int b, bi;
+  struct buf *bp;
+
+  for(b = from - from%BPB; b < to; b += BPB){
+    bp = bread(dev, IMBLOCK(b, sb));
+    bi = bfirstfree((uint*)bp->data, b < from ? from - b : 0,
+                    min(BPB, to - b));
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark inode in use.
+      log_write(bp);
+      brelse(bp);
+      return b + bi;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Take a free inode number from the inode map.
+// Returns 0 if there are none.
+static uint
+imapalloc(uint dev)
+{
+  uint from, inum;
+
+  acquire(&inodemap.lock);
+  if(inodemap.nfree == 0){
+    release(&inodemap.lock);
+    return 0;
+  }
+  inodemap.nfree--;  // one is ours, so the scan will find it
+  from = inodemap.hint;
+  release(&inodemap.lock);
+
+  if((inum = imapscan(dev, from, sb.ninodes)) == 0 &&
+     (inum = imapscan(dev, 1, from)) == 0)
+    panic("imapalloc: map disagrees with count");
+
+  acquire(&inodemap.lock);
+  inodemap.hint = inum + 1;
+  release(&inodemap.lock);
+  return inum;
+}
+
+// Return inode inum to the inode map.
+static void
+imapfree(uint dev, uint inum)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, IMBLOCK(inum, sb));
+  bi = inum % BPB;
+  m = 1 << (bi % 8);
+  if((bp->data[bi/8] & m) == 0)
+    panic("freeing free inode");
+  bp->data[bi/8] &= ~m;
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&inodemap.lock);
+  inodemap.nfree++;
+  if(inum < inodemap.hint)
+    inodemap.hint = inum;
+  release(&inodemap.lock);
 }
 
 // Inodes.
@@ -120,18 +311,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero stays in the cache, on a
+//   least-recently-used list, until iget() recycles it for
+//   another inode; if iget() finds it first, it is reused
+//   without reading the disk.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,35 +348,93 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The cache finds entries through a hash table on (dev, inum).
+// It starts with NINODE entries and, when all of them are
+// referenced, grows by a page of entries at a time.
+//
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those
+// fields, or the hash chain and LRU list links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61  // buckets in the inode cache hash table
+
 struct {
   struct spinlock lock;
+  struct inode *hash[NIHASH];
+
+  // Unreferenced entries, least recently used first.
+  // lru.lrunext is the next entry to recycle.
+  struct inode lru;
   struct inode inode[NINODE];
 } icache;
 
+// Append ip to the LRU list.
+static void
+lruput(struct inode *ip)
+{
+  ip->lrunext = &icache.lru;
+  ip->lruprev = icache.lru.lruprev;
+  icache.lru.lruprev->lrunext = ip;
+  icache.lru.lruprev = ip;
+}
+
+static void
+lruremove(struct inode *ip)
+{
+  ip->lruprev->lrunext = ip->lrunext;
+  ip->lrunext->lruprev = ip->lruprev;
+}
+
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Add a page of new entries to the cache.
+// Returns -1 if there is no memory.
+static int
+igrow(void)
+{
+  struct inode *ip, *end;
+
+  if((ip = (struct inode*)kalloc()) == 0)
+    return -1;
+  memset(ip, 0, PGSIZE);
+  for(end = ip + PGSIZE/sizeof(*ip); ip < end; ip++){
+    initsleeplock(&ip->lock, "inode");
+    lruput(ip);
+  }
+  return 0;
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
 
   initlock(&icache.lock, "icache");
+  dcinit();
+  icache.lru.lruprev = &icache.lru;
+  icache.lru.lrunext = &icache.lru;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    lruput(&icache.inode[i]);
   }
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d imap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.imapstart);
+  bcountinit(dev);
+  imapinit(dev);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -199,19 +450,17 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
-  }
-  panic("ialloc: no inodes");
+  if((inum = imapalloc(dev)) == 0)
+    panic("ialloc: no inodes");
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -242,31 +491,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry,
+  // making more if all are in use.
+  if(icache.lru.lrunext == &icache.lru && igrow() < 0)
     panic("iget: no inodes");
+  ip = icache.lru.lrunext;
+  lruremove(ip);
+  if(ip->inum != 0){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  pp = ihash(dev, inum);
+  ip->hnext = *pp;
+  *pp = ip;
   release(&icache.lock);
 
   return ip;
@@ -297,7 +554,7 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    bp = bread_shared(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
@@ -306,6 +563,7 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->goal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -339,16 +597,20 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
+      imapfree(ip->dev, ip->inum);
       ip->valid = 0;
     }
   }
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruput(ip);
   release(&icache.lock);
 }
 
@@ -366,38 +628,98 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// those in a two-level tree rooted at ip->addrs[NDIRECT+1],
+// and the NTINDIRECT after those in a three-level tree
+// rooted at ip->addrs[NDIRECT+2].
+
+// Are ip's data blocks written in place rather than logged?
+// In ordered-data mode, regular file data goes straight to its
+// home location before the transaction that allocates it
+// commits; only metadata is journaled.
+static int
+inplace(struct inode *ip)
+{
+#ifdef ORDERED_DATA
+  return ip->type == T_FILE;
+#else
+  return 0;
+#endif
+}
+
+// Allocate a block for ip, next to the last one allocated.
+// If data is set, the block will hold file data rather than
+// block numbers.
+static uint
+iballoc(struct inode *ip, int data)
+{
+  uint addr;
+
+  addr = balloc(ip->dev, ip->goal, data && inplace(ip));
+  ip->goal = addr + 1;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, n, *a;
+  int level;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip, 1);
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the tree holding bn; level is its depth and
+  // n the number of blocks it maps.
+  for(level = 1, n = NINDIRECT; bn >= n; level++, n *= NINDIRECT){
+    if(level == 3)
+      panic("bmap: out of range");
+    bn -= n;
+  }
+
+  // Walk down the tree, allocating indirect blocks as needed.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = iballoc(ip, 0);
+  for(; level > 0; level--){
+    n /= NINDIRECT;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn/n]) == 0){
+      a[bn/n] = addr = iballoc(ip, level == 1);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    bn %= n;
   }
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free the indirect block addr, with the level levels of
+// blocks below it.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  if(level > 0){
+    bp = bread(dev, addr);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        ifree(dev, a[j], level-1);
+    }
+    brelse(bp);
+  }
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -408,31 +730,53 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
+  for(i = 0; i < NDIRECT+3; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      ifree(ip->dev, ip->addrs[i], i < NDIRECT ? 0 : i-NDIRECT+1);
       ip->addrs[i] = 0;
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  ip->size = 0;
+  ip->goal = 0;
+  iupdate(ip);
+}
+
+// Allocate the blocks holding bytes [off, off+n) of ip,
+// growing the file to cover them.  The blocks come from one
+// run on disk when the free space allows.
+// Caller must hold ip->lock.
+int
+iprealloc(struct inode *ip, uint off, uint n)
+{
+  uint bn;
+  struct buf *bp;
+
+  if(ip->type != T_FILE)
+    return -1;
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+
+  for(bn = off/BSIZE; bn*BSIZE < off + n; bn++){
+    if(bn*BSIZE < ip->size || !inplace(ip)){
+      bmap(ip, bn);
+      continue;
     }
+    // New in-place blocks are not zeroed by balloc.
+    bp = bread(ip->dev, bmap(ip, bn));
+    memset(bp->data, 0, BSIZE);
+    bwrite(bp);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
-  ip->size = 0;
+  if(off + n > ip->size)
+    ip->size = off + n;
   iupdate(ip);
+  return n;
 }
 
 // Copy stat information from inode.
@@ -453,8 +797,9 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, fbn, nb, addr;
+  int i, run;
+  struct buf *bs[NBATCH];
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -467,15 +812,70 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+  for(tot=0; tot<n; ){
+    // Find how many of the blocks still to be read sit
+    // next to each other on disk, and read them together.
+    fbn = off/BSIZE;
+    nb = (off + n - tot + BSIZE - 1)/BSIZE - fbn;
+    addr = bmap(ip, fbn);
+    for(run = 1; run < nb && run < NBATCH; run++)
+      if(bmap(ip, fbn + run) != addr + run)
+        break;
+    run = breadn_shared(ip->dev, addr, bs, run);
+    for(i = 0; i < run; i++, tot+=m, off+=m, dst+=m){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(dst, bs[i]->data + off%BSIZE, m);
+      brelse(bs[i]);
+    }
   }
   return n;
 }
 
+// Write file data home now, a batch at a time, so it is on
+// disk before the transaction that allocated it commits.
+// A batch's blocks are mapped first, with no buf held, and
+// then locked in ascending block order, as checkpoint() in
+// log.c does, so neither can deadlock waiting on the other.
+// Only a block partly overwritten and holding file data is
+// read first; new blocks and whole-block writes are not.
+static void
+writehome(struct inode *ip, char *src, uint off, uint n)
+{
+  struct buf *bs[NBATCH];
+  uint addr[NBATCH], tot, m, fbn, boff;
+  int i, j, nb, ord[NBATCH], full[NBATCH];
+
+  for(tot=0; tot<n; ){
+    fbn = off/BSIZE;
+    nb = (off + n - tot + BSIZE - 1)/BSIZE - fbn;
+    if(nb > NBATCH)
+      nb = NBATCH;
+    m = n - tot;
+    for(i = 0; i < nb; i++){
+      addr[i] = bmap(ip, fbn + i);
+      for(j = i; j > 0 && addr[ord[j-1]] > addr[i]; j--)
+        ord[j] = ord[j-1];
+      ord[j] = i;
+      boff = i == 0 ? off%BSIZE : 0;
+      full[i] = (fbn + i)*BSIZE >= ip->size || (boff == 0 && m >= BSIZE);
+      m -= min(m, BSIZE - boff);
+    }
+    for(i = 0; i < nb; i++){
+      j = ord[i];
+      bs[j] = full[j] ? bnew(ip->dev, addr[j]) : bread(ip->dev, addr[j]);
+    }
+    for(i = 0; i < nb; i++, tot+=m, off+=m, src+=m){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if((fbn + i)*BSIZE >= ip->size)
+        memset(bs[i]->data, 0, BSIZE);  // new block, not zeroed by balloc
+      memmove(bs[i]->data + off%BSIZE, src, m);
+    }
+    bwriten(bs, nb);
+    for(i = 0; i < nb; i++)
+      brelse(bs[i]);
+  }
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -496,12 +896,17 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+  if(inplace(ip)){
+    writehome(ip, src, off, n);
+    off += n;
+  } else {
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(bp->data + off%BSIZE, src, m);
+      log_write(bp);
+      brelse(bp);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -520,32 +925,187 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// The dcache remembers the results of recent dirlookups:
+// the inum and offset of name in directory dinum, or, if
+// inum is 0, that dinum has no entry for name.  It is a
+// direct-mapped table indexed by a hash of the key, so a
+// new entry simply replaces whatever was in its slot.
+//
+// Callers hold the directory's lock, which keeps its
+// entries from changing under them; dcache.lock protects
+// the table itself.  dirlink and sys_unlink must keep the
+// cache up to date with the directory's contents.
+
+struct dcentry {
+  uint dev;
+  uint dinum;         // directory; 0 if slot is unused
+  char name[DIRSIZ];
+  uint inum;          // 0 if dinum has no entry for name
+  uint off;
+};
+
+struct {
+  struct spinlock lock;
+  struct dcentry entry[NDCACHE];
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dcentry*
+dcslot(uint dev, uint dinum, char *name)
+{
+  return &dcache.entry[(dirhash(name) ^ (dev*31 + dinum)) % NDCACHE];
+}
+
+// Look for name in directory dp in the dcache.
+// Returns 0 on a miss, else 1 with *pinum and *poff set.
+static int
+dclookup(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct dcentry *e;
+  int hit;
+
+  acquire(&dcache.lock);
+  e = dcslot(dp->dev, dp->inum, name);
+  hit = e->dinum == dp->inum && e->dev == dp->dev &&
+        namecmp(name, e->name) == 0;
+  if(hit){
+    *pinum = e->inum;
+    *poff = e->off;
+  }
+  release(&dcache.lock);
+  return hit;
+}
+
+// Record that name in directory dp is inode inum at offset
+// off, or that it is not there if inum is 0.
+static void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  e = dcslot(dp->dev, dp->inum, name);
+  e->dev = dp->dev;
+  e->dinum = dp->inum;
+  strncpy(e->name, name, DIRSIZ);
+  e->inum = inum;
+  e->off = off;
+  release(&dcache.lock);
+}
+
+// Forget what the dcache knows about name in directory dp.
+void
+dcforget(struct inode *dp, char *name)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  e = dcslot(dp->dev, dp->inum, name);
+  if(e->dinum == dp->inum && e->dev == dp->dev &&
+     namecmp(name, e->name) == 0)
+    e->dinum = 0;
+  release(&dcache.lock);
+}
+
+// Forget all entries for directory dinum, which is being freed.
+static void
+dcpurge(uint dev, uint dinum)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.entry; e < &dcache.entry[NDCACHE]; e++)
+    if(e->dinum == dinum && e->dev == dev)
+      e->dinum = 0;
+  release(&dcache.lock);
+}
+
+// Scan the entries in blocks [from, to) of directory dp for
+// name, or for a free entry if name is 0.  Returns the byte
+// offset of the entry found, setting *pinum, or -1 if none.
+static int
+dirscan(struct inode *dp, uint from, uint to, char *name, uint *pinum)
+{
+  struct buf *bp;
+  struct dirent *de, *end;
+  uint bn;
+  int off;
+
+  off = -1;
+  for(bn = from; bn < to && off < 0; bn++){
+    if(bn*BSIZE >= dp->size)
+      break;  // a bucket past the end was never written
+    bp = bread_shared(dp->dev, bmap(dp, bn));
+    end = (struct dirent*)(bp->data + min(BSIZE, dp->size - bn*BSIZE));
+    for(de = (struct dirent*)bp->data; de < end; de++){
+      if(name ? de->inum != 0 && namecmp(name, de->name) == 0
+              : de->inum == 0){
+        off = bn*BSIZE + (uchar*)de - bp->data;
+        *pinum = de->inum;
+        break;
+      }
+    }
+    brelse(bp);
+  }
+  return off;
+}
+
+// Scan directory dp for name, or for a free entry if name
+// is 0.  If dp has a hash index (dp->minor buckets), only the
+// bucket block for key and the overflow blocks after the
+// buckets are searched.
+static int
+dirfind(struct inode *dp, char *key, char *name, uint *pinum)
+{
+  uint nb, nbucket, h;
+  int off;
+
+  nb = (dp->size + BSIZE - 1) / BSIZE;
+  nbucket = dp->minor;
+  if(nbucket == 0)
+    return dirscan(dp, 0, nb, name, pinum);
+  h = dirhash(key) % nbucket;
+  if((off = dirscan(dp, h, h+1, name, pinum)) >= 0)
+    return off;
+  return dirscan(dp, nbucket, nb, name, pinum);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint inum;
+  int off;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(dclookup(dp, name, &inum, (uint*)&off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
   }
 
-  return 0;
+  if((off = dirfind(dp, name, name, &inum)) < 0){
+    dcenter(dp, name, 0, 0);
+    return 0;
+  }
+
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  dcenter(dp, name, inum, off);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -553,6 +1113,7 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint n;
   struct dirent de;
   struct inode *ip;
 
@@ -562,18 +1123,15 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
+  // Look for an empty dirent, else append one.
+  if((off = dirfind(dp, name, 0, &n)) < 0)
+    off = dp->size;
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum, off);
 
   return 0;
 }
@@ -657,6 +1215,37 @@ namex(char *path, int nameiparent, char *name)
   return ip;
 }
 
+// Number of elements in path, as namex() walks them.
+int
+pathlen(char *path)
+{
+  char name[DIRSIZ];
+  int n;
+
+  for(n = 0; (path = skipelem(path, name)) != 0; n++)
+    ;
+  return n;
+}
+
+// Log blocks to reserve for an operation that writes up to
+// extra blocks and calls iput() up to niput times.  Each iput
+// may drop the last reference to an unlinked inode and free
+// it, writing its inode block, an inode map block and bitmap
+// blocks; the frees share the maps, and touch no more inode
+// blocks than there are.  Only a path deep enough to free a
+// great many inodes could need more than the log allows, so
+// the result is capped there.
+int
+opblocks(int niput, int extra)
+{
+  int n;
+
+  if(niput > sb.ninodes/IPB + 1)
+    niput = sb.ninodes/IPB + 1;
+  n = niput + (sb.ninodes/BPB + 1) + (sb.size/BPB + 1) + extra;
+  return n < log_maxop() ? n : log_maxop();
+}
+
 struct inode*
 namei(char *path)
 {
@@ -6,7 +6,7 @@
 #define BSIZE 512  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks |
+// [ boot block | super block | log | inode blocks | inode bit map |
 //                                          free bit map | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
@@ -19,21 +19,26 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint imapstart;    // Block number of first inode map block
 };
 
-#define NDIRECT 12
+// An inode lists NDIRECT data blocks directly, then the roots of
+// a single, a double and a triple indirect tree of block numbers.
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
   short major;          // Major device number (T_DEV only)
-  short minor;          // Minor device number (T_DEV only)
+  short minor;          // Minor device number (T_DEV), hash buckets (T_DIR)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses
 };
 
 // Inodes per block.
@@ -48,6 +53,9 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
 
+// Block of inode map containing bit for inode i
+#define IMBLOCK(i, sb) ((i)/BPB + sb.imapstart)
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -56,3 +64,20 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory may carry a hash index: if its minor number is
+// nonzero, its first minor blocks are hash buckets, and an entry
+// goes in block dirhash(name) % minor unless that block is full.
+// Entries that do not fit in their bucket go in the blocks after
+// the buckets, which are searched linearly.
+static inline uint
+dirhash(const char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
@@ -22,7 +22,7 @@ grep(char *pattern, int fd)
       *q = 0;
       if(match(pattern, p)){
         *q = '\n';
-        write(1, p, q+1 - p);
+        bufwrite(1, p, q+1 - p);
       }
       p = q+1;
     }
@@ -52,6 +52,7 @@ main(int argc, char *argv[])
     exit();
   }
 
+  bufmode(1, BUF_FULL);
   for(i = 2; i < argc; i++){
     if((fd = open(argv[i], 0)) < 0){
       printf(1, "grep: cannot open %s\n", argv[i]);
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses bus-master DMA when the
+// controller supports it, programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,15 +25,67 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// PCI configuration space, for finding the bus-master registers.
+#define PCI_CONFADDR  0xcf8
+#define PCI_CONFDATA  0xcfc
+#define PCI_CMD       0x04  // command/status register
+#define PCI_CLASS     0x08  // class, subclass, prog-if, revision
+#define PCI_BAR4      0x20
+#define PCI_CMD_MASTER 0x04 // bus master enable
+
+// Primary channel bus-master registers, relative to BAR4.
+#define BM_CMD        0x0
+#define BM_STATUS     0x2
+#define BM_PRDT       0x4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_STAT_ERR   0x02
+#define BM_STAT_INTR  0x04
+
+// Physical region descriptor.  A region may not cross a 64K boundary.
+struct prd {
+  uint addr;
+  ushort count;         // bytes; 0 means 64K
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry in table
+
+// Pending requests wait in two heaps ordered by (dev, blockno)
+// and are served in C-LOOK order: the disk sweeps upward through
+// sweep[cursweep], which holds the requests beyond the last block
+// it was sent to.  Requests that arrive behind that point go into
+// the other heap and wait for the next sweep; when the current
+// sweep runs dry the heaps swap roles.
+//
+// idequeue points to the bufs now being read/written to the disk,
+// linked through qnext.  Requests for consecutive blocks that
+// come off the heap together are merged into one command.
+// You must hold idelock while manipulating the queue.
+
+struct reqheap {
+  int n;
+  struct buf *b[NBUF];
+};
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenrun;              // bufs in the active command
+static struct reqheap sweep[2];
+static int cursweep;
+static uint headdev, headblock;  // last block the disk was sent to
+
+static uint idestamp;            // when the active command started
+static struct iostat idestats[2];
 
 static int havedisk1;
+static int idemaxsect;  // max sectors moved by one command
+static int idepiosect;  // idemaxsect without DMA
+static ushort idebm;    // bus-master register base, 0 if no DMA
+static struct prd *ideprdt;
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -47,6 +101,60 @@ idewait(int checkerr)
   return 0;
 }
 
+// Set the number of sectors disk dev moves per READ/WRITE
+// MULTIPLE data transfer.  Returns -1 if the disk refuses.
+static int
+idesetmult(int dev, int nsect)
+{
+  idewait(0);
+  outb(0x1f6, 0xe0 | ((dev&1)<<4));
+  outb(0x1f2, nsect);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
+static uint
+pciread(int bus, int dev, int func, int off)
+{
+  outl(PCI_CONFADDR, 0x80000000 | bus<<16 | dev<<11 | func<<8 | off);
+  return inl(PCI_CONFDATA);
+}
+
+static void
+pciwrite(int bus, int dev, int func, int off, uint v)
+{
+  outl(PCI_CONFADDR, 0x80000000 | bus<<16 | dev<<11 | func<<8 | off);
+  outl(PCI_CONFDATA, v);
+}
+
+// Look for an IDE controller on PCI bus 0 that can do bus-master
+// DMA, and if there is one, enable it and allocate its PRD table.
+static void
+idedmainit(void)
+{
+  int dev, func;
+  uint class, bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(func = 0; func < 8; func++){
+      if((pciread(0, dev, func, 0) & 0xffff) == 0xffff)
+        continue;
+      class = pciread(0, dev, func, PCI_CLASS);
+      if((class >> 16) != 0x0101 || !(class & 0x8000))
+        continue;  // not IDE, or no bus master
+      bar = pciread(0, dev, func, PCI_BAR4);
+      if(!(bar & 1) || (bar & ~3) == 0)
+        continue;  // not an assigned I/O port range
+      if((ideprdt = (struct prd*)kalloc()) == 0)
+        return;
+      pciwrite(0, dev, func, PCI_CMD,
+               pciread(0, dev, func, PCI_CMD) | PCI_CMD_MASTER);
+      idebm = bar & 0xfffc;
+      return;
+    }
+  }
+}
+
 void
 ideinit(void)
 {
@@ -65,35 +173,190 @@ ideinit(void)
     }
   }
 
+  // Let a run of up to NBATCH blocks go to the disk as one
+  // command.  If a disk refuses, move one block per command.
+  outb(0x3f6, 0x02);  // no interrupts while setting up
+  idemaxsect = NBATCH * (BSIZE/SECTOR_SIZE);
+  if(idemaxsect > 255 || idesetmult(0, idemaxsect) < 0 ||
+     (havedisk1 && idesetmult(1, idemaxsect) < 0))
+    idemaxsect = BSIZE/SECTOR_SIZE;
+  idepiosect = idemaxsect;
+
+  // With DMA the sector count register is the only limit.
+  idedmainit();
+  if(idebm)
+    idemaxsect = 255;
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Current time for iostat, in units of 1024 cycles.
+static uint
+idetime(void)
+{
+  return rdtsc() >> 10;
+}
+
+// Does a come before b in sweep order?
+static int
+reqless(struct buf *a, struct buf *b)
+{
+  if(a->dev != b->dev)
+    return a->dev < b->dev;
+  return a->blockno < b->blockno;
+}
+
+static void
+heappush(struct reqheap *h, struct buf *b)
+{
+  int i;
+
+  for(i = h->n++; i > 0 && reqless(b, h->b[(i-1)/2]); i = (i-1)/2)
+    h->b[i] = h->b[(i-1)/2];
+  h->b[i] = b;
+}
+
+static struct buf*
+heappop(struct reqheap *h)
+{
+  struct buf *top, *last;
+  int i, c;
+
+  top = h->b[0];
+  last = h->b[--h->n];
+  for(i = 0; (c = 2*i+1) < h->n; i = c){
+    if(c+1 < h->n && reqless(h->b[c+1], h->b[c]))
+      c++;
+    if(!reqless(h->b[c], last))
+      break;
+    h->b[i] = h->b[c];
+  }
+  h->b[i] = last;
+  return top;
+}
+
+// Queue b for the disk.  Caller must hold idelock.
+static void
+ideenqueue(struct buf *b)
+{
+  struct iostat *st = &idestats[b->dev&1];
+
+  b->qnext = 0;
+  b->qstamp = idetime();
+  if(b->dev > headdev || (b->dev == headdev && b->blockno > headblock))
+    heappush(&sweep[cursweep], b);
+  else
+    heappush(&sweep[!cursweep], b);
+  if(++st->qdepth > st->maxqdepth)
+    st->maxqdepth = st->qdepth;
+}
+
+// Take the next request in C-LOOK order off the heaps, together
+// with the queued requests for the blocks right after it going
+// the same direction, and start the disk on them.
+// Caller must hold idelock.
+static void
+idenext(void)
+{
+  struct reqheap *h;
+  struct buf *b, *last;
+  int n;
+
+  if(sweep[cursweep].n == 0)
+    cursweep = !cursweep;  // wrap around to the lowest block
+  h = &sweep[cursweep];
+  if(h->n == 0){
+    idequeue = 0;
+    return;
+  }
+
+  idequeue = last = heappop(h);
+  for(n = 1; h->n > 0 && (n+1)*(BSIZE/SECTOR_SIZE) <= idemaxsect; n++){
+    b = h->b[0];
+    if(b->dev != last->dev || b->blockno != last->blockno + 1 ||
+       (b->flags & B_DIRTY) != (last->flags & B_DIRTY))
+      break;
+    last->qnext = heappop(h);
+    last = last->qnext;
+  }
+  last->qnext = 0;
+  headdev = last->dev;
+  headblock = last->blockno;
+  idenrun = n;
+  idestart(idequeue);
+}
+
+// Point the bus-master at the data of the idenrun bufs starting
+// with b and set the transfer direction, ready for a DMA command.
+static void
+idedmaload(struct buf *b)
+{
+  struct prd *d;
+  uint pa, end, n;
+  int i, write;
+
+  write = b->flags & B_DIRTY;
+  d = ideprdt;
+  for(i = 0; i < idenrun; i++, b = b->qnext){
+    pa = V2P(b->data);
+    end = pa + BSIZE;
+    for(; pa < end; pa += n, d++){
+      n = end - pa;
+      if((pa & 0xffff) + n > 0x10000)
+        n = 0x10000 - (pa & 0xffff);
+      d->addr = pa;
+      d->count = n;
+      d->flags = 0;
+    }
+  }
+  d[-1].flags = PRD_EOT;
+
+  outl(idebm+BM_PRDT, V2P(ideprdt));
+  outb(idebm+BM_CMD, write ? 0 : BM_CMD_READ);
+  // Clear error and interrupt, keeping the drive DMA-capable bits.
+  outb(idebm+BM_STATUS, inb(idebm+BM_STATUS) | BM_STAT_ERR|BM_STAT_INTR);
+}
+
+// Start the request for the idenrun bufs for consecutive
+// blocks starting with b.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *p;
+  int i;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno + idenrun > FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsect = idenrun * sector_per_block;
+  int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  idestats[b->dev&1].ncmd++;
+  idestamp = idetime();
+
   idewait(0);
+  if(idebm)
+    idedmaload(b);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(i = 0, p = b; i < idenrun; i++, p = p->qnext)
+      outsl(0x1f0, p->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,66 +366,121 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *p;
+  struct iostat *st;
+  uint now;
+  int i, stat;
 
-  // First queued buffer is the active request.
+  // idequeue holds the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // The data has already moved; stop the engine and check it.
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) & ~BM_CMD_START);
+    stat = inb(idebm+BM_STATUS);
+    outb(idebm+BM_STATUS, stat | BM_STAT_ERR|BM_STAT_INTR);
+    idewait(0);  // acknowledge the disk's interrupt
+    if(stat & BM_STAT_ERR){
+      // Stop using DMA, and queue the bufs again to be moved
+      // by programmed I/O in commands that path can handle.
+      cprintf("ide: dma error, using pio\n");
+      idebm = 0;
+      idemaxsect = idepiosect;
+      while((b = idequeue) != 0){
+        idequeue = b->qnext;
+        idestats[b->dev&1].qdepth--;
+        ideenqueue(b);
+      }
+      idenext();
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+    // Read data if needed.
+    for(i = 0, p = b; i < idenrun; i++, p = p->qnext)
+      insl(0x1f0, p->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for these bufs.
+  now = idetime();
+  st = &idestats[b->dev&1];
+  st->svctime += now - idestamp;
+  while((b = idequeue) != 0){
+    idequeue = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    st->nreq++;
+    st->qdepth--;
+    st->waittime += now - b->qstamp;
+    wakeup(b);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on next request.
+  idenext();
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Sync bufs with disk.
+// For each buf: if B_DIRTY is set, write buf to disk, clear B_DIRTY,
+// set B_VALID.  Else if B_VALID is not set, read buf from disk, set
+// B_VALID.  All the bufs are queued before the disk is started, so
+// bufs for consecutive blocks are moved with one multi-sector command.
 void
-iderw(struct buf *b)
+iderwv(struct buf **bs, int n)
 {
-  struct buf **pp;
+  int i;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("iderw: buf not locked");
+    if((bs[i]->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(bs[i]->dev != 0 && !havedisk1)
+      panic("iderw: ide disk 1 not present");
+  }
+  if(n == 0)
+    return;
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  for(i = 0; i < n; i++)
+    ideenqueue(bs[i]);  //DOC:insert-queue
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idequeue == 0)
+    idenext();
 
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+  // Wait for requests to finish.
+  for(i = 0; i < n; i++){
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID){
+      sleep(bs[i], &idelock);
+    }
   }
 
+  release(&idelock);
+}
 
+// Sync one buf with disk.
+void
+iderw(struct buf *b)
+{
+  iderwv(&b, 1);
+}
+
+// Copy the queue statistics for disk dev into st.
+int
+idestat(int dev, struct iostat *st)
+{
+  if(dev < 0 || dev > 1)
+    return -1;
+  acquire(&idelock);
+  *st = idestats[dev];
   release(&idelock);
+  return 0;
 }
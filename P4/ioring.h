@@ -0,0 +1,30 @@
+// Submission and completion rings for batching system calls;
+// see ioring_setup() and ioring_enter() in syscall.c.  The
+// process owns the memory.  It fills sq[] and advances sqtail,
+// and the kernel advances sqhead as it runs each entry and
+// posts the result at cqtail.  The process reads completions
+// from cqhead.  Indexes run freely and wrap modulo IORING_SIZE.
+
+#define IORING_SIZE 64  // entries per ring; a power of two
+
+// Submission: one system call to run.
+struct iosqe {
+  int num;      // SYS_ number
+  int args[6];  // arguments, as the call would take them
+  int user;     // passed through to the completion
+};
+
+// Completion: what the call returned.
+struct iocqe {
+  int user;
+  int ret;
+};
+
+struct ioring {
+  uint sqhead;  // next submission the kernel runs
+  uint sqtail;  // next free submission slot
+  uint cqhead;  // next completion to read
+  uint cqtail;  // next free completion slot
+  struct iosqe sq[IORING_SIZE];
+  struct iocqe cq[IORING_SIZE];
+};
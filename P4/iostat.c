@@ -0,0 +1,22 @@
+#include "types.h"
+#include "user.h"
+#include "iostat.h"
+
+// Print the disk request queue statistics for each disk.
+int
+main(void)
+{
+  struct iostat st;
+  int dev;
+
+  printf(1, "dev\treqs\tcmds\tqdepth\tmaxq\twait/req\tsvc/cmd (Kcycles)\n");
+  for(dev = 0; dev < 2; dev++){
+    if(iostat(dev, &st) < 0)
+      continue;
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t\t%d\n", dev, st.nreq, st.ncmd,
+           st.qdepth, st.maxqdepth,
+           st.nreq ? st.waittime / st.nreq : 0,
+           st.ncmd ? st.svctime / st.ncmd : 0);
+  }
+  exit();
+}
@@ -0,0 +1,10 @@
+// Per-disk request queue statistics, as returned by iostat().
+// Times are in units of 1024 CPU cycles.
+struct iostat {
+  uint nreq;       // block requests completed
+  uint ncmd;       // disk commands issued, after merging
+  uint qdepth;     // block requests queued or in progress now
+  uint maxqdepth;  // deepest the queue has been
+  uint waittime;   // total time from queueing to completion
+  uint svctime;    // total time the disk spent on commands
+};
@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -14,11 +16,20 @@
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
-// A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// A system call should call begin_opn()/end_op() to mark
+// its start and end. Usually begin_opn() just reserves log
+// space for the blocks the call may write (see opblocks()
+// in fs.c and writeblocks() in file.c; begin_op() reserves
+// MAXOPBLOCKS) and returns.  But if the reservations would
+// run past the end of the log, it sleeps until the last
+// outstanding end_op() commits.  end_op() returns the
+// reservation.  The log size is chosen by mkfs, up to
+// LOGSIZE blocks.
+//
+// Commits are pipelined: the last end_op() of a transaction
+// copies its blocks aside and lets the next transaction start
+// while it writes the copies to the log.  Only one commit is
+// written at a time.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,6 +39,14 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Committed transactions are not copied to their home locations
+// right away.  Each commit appends its blocks after those of the
+// transactions before it, so a commit costs one sequential log
+// write plus the header.  The blocks stay pinned in the buffer
+// cache, and only when the log is getting full does a checkpoint
+// write each of them home once, however many transactions
+// changed it, and empty the log.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,18 +60,31 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by them
   int committing;  // in commit(), please wait.
+  int committed;   // log entries before the current transaction
+  int writing;     // a commit is being written to the log
   int dev;
   struct logheader lh;
+  char *snap[(LOGSIZE*BSIZE + PGSIZE-1) / PGSIZE];  // commit's copies
+  int nsnap;       // pages in snap
+  // Blocks freed by the current transaction, and by the commit
+  // being written, a bit per block; see log_freed().
+  uint freed[2][(FSSIZE+31)/32];
+  int curfreed;    // which of freed[] the current transaction uses
 };
 struct log log;
 
+#define SNAPPG (PGSIZE/BSIZE)  // blocks per snapshot page
+
 static void recover_from_log(void);
 static void commit();
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
@@ -62,22 +94,35 @@ initlog(int dev)
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  if (log.size - 1 > LOGSIZE || log.size - 1 < 3*MAXOPBLOCKS)
+    panic("initlog: bad log size");
+  log.nsnap = ((log.size-1)*BSIZE + PGSIZE-1) / PGSIZE;
+  for (i = 0; i < log.nsnap; i++)
+    if ((log.snap[i] = kalloc()) == 0)
+      panic("initlog: no memory");
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// The log blocks are contiguous, so they are read a run
+// at a time.
 static void
 install_trans(void)
 {
-  int tail;
+  struct buf *lbuf[NBATCH], *dbuf[NBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = breadn(log.dev, log.start+tail+1, lbuf, log.lh.n - tail); // read log blocks
+    for (i = 0; i < n; i++) {
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+    }
+    bwriten(dbuf, n);  // write dst to disk
+    for (i = 0; i < n; i++) {
+      brelse(lbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -95,17 +140,17 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the first n entries of the in-memory log header
+// to disk.  This is the true point at which the
+// transaction ending at entry n commits.
 static void
-write_head(void)
+write_head(int n)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
+  hb->n = n;
+  for (i = 0; i < n; i++) {
     hb->block[i] = log.lh.block[i];
   }
   bwrite(buf);
@@ -118,28 +163,102 @@ recover_from_log(void)
   read_head();
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.committed = 0;
+  write_head(0); // clear the log
 }
 
-// called at the start of each FS system call.
+// Write the blocks of all committed transactions home from
+// the buffer cache, where they are pinned, and empty the log.
+// Only called with log.committing set and no operation
+// running, so the cached copies hold no uncommitted changes.
+//
+// The blocks are locked a batch at a time in ascending block
+// order, the order every holder of several bufs uses (see
+// breadn() and writehome() in fs.c), so a checkpoint cannot
+// deadlock with a reader or an in-place write.
+static void
+checkpoint(void)
+{
+  static int home[LOGSIZE];  // one checkpoint runs at a time
+  struct buf *bs[NBATCH];
+  int i, j, n, nhome;
+
+  // Each logged block once, sorted.
+  nhome = 0;
+  for (i = 0; i < log.lh.n; i++) {
+    for (j = nhome; j > 0 && home[j-1] > log.lh.block[i]; j--)
+      ;
+    if (j > 0 && home[j-1] == log.lh.block[i])
+      continue;  // logged by more than one transaction
+    memmove(&home[j+1], &home[j], (nhome - j) * sizeof(home[0]));
+    home[j] = log.lh.block[i];
+    nhome++;
+  }
+
+  for (i = 0; i < nhome; i += n) {
+    n = nhome - i < NBATCH ? nhome - i : NBATCH;
+    for (j = 0; j < n; j++)
+      bs[j] = bread(log.dev, home[i+j]);
+    bwriten(bs, n);  // write home, clearing B_DIRTY
+    for (j = 0; j < n; j++)
+      brelse(bs[j]);
+  }
+  log.lh.n = 0;
+  log.committed = 0;
+  write_head(0);   // Erase the transactions from the log
+}
+
+// called at the start of each FS system call that may
+// write up to n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log.size - 1)
+    panic("begin_op: too big");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + n > log.size - 1){
+      if(log.outstanding == 0 && !log.writing){
+        // Committed transactions fill the log and no commit
+        // is coming to make room, so checkpoint now.
+        log.committing = 1;
+        release(&log.lock);
+        checkpoint();
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+      } else {
+        // this op might exhaust log space; wait for commit.
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logreserved = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// The most blocks one FS system call may reserve: half the
+// log, so two of the largest can run at once.
+int
+log_maxop(void)
+{
+  return (log.size - 1) / 2;
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
@@ -149,6 +268,7 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logreserved;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
@@ -156,7 +276,7 @@ end_op(void)
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
@@ -166,44 +286,113 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Where the copy of entry i of a commit starting at log
+// entry start is kept.
+static char*
+snapblock(int start, int i)
+{
+  i -= start;
+  return log.snap[i / SNAPPG] + (i % SNAPPG) * BSIZE;
+}
+
+// Copy the blocks of log entries [start, end) aside from
+// the cache, so later transactions can change them.
+static void
+snapshot(int start, int end)
+{
+  struct buf *bp;
+  int i;
+
+  for (i = start; i < end; i++) {
+    bp = bread(log.dev, log.lh.block[i]);
+    memmove(snapblock(start, i), bp->data, BSIZE);
+    brelse(bp);
+  }
+}
+
+// Copy the snapshot of log entries [start, end) to the log,
+// after the committed transactions.
+// Each run of log blocks goes to the disk as one request.
 static void
-write_log(void)
+write_log(int start, int end)
 {
-  int tail;
+  struct buf *to[NBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = start; tail < end; tail += n) {
+    n = breadn(log.dev, log.start+tail+1, to, end - tail); // log blocks
+    for (i = 0; i < n; i++)
+      memmove(to[i]->data, snapblock(start, tail+i), BSIZE);
+    bwriten(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
+// Commit the current transaction.  Called with log.committing
+// set, so no FS operation is running and none can start.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int start, end, freed;
+
+  // Wait for the previous commit to reach the disk.
+  acquire(&log.lock);
+  while (log.writing)
+    sleep(&log, &log.lock);
+  // The blocks this transaction freed stay off limits to
+  // in-place writes until its header is on disk.
+  freed = log.curfreed;
+  log.curfreed = !freed;
+  release(&log.lock);
+
+  start = log.committed;
+  end = log.lh.n;
+  snapshot(start, end);
+
+  if (end + 2*MAXOPBLOCKS > log.size - 1) {
+    // There is no longer room for two more operations.
+    // Finish this commit and checkpoint before any operation
+    // starts, so that the cache holds only committed data and
+    // begin_op() can proceed afterwards.
+    write_log(start, end);  // Write modified blocks to log
+    write_head(end);        // Write header to disk -- the real commit
+    checkpoint();
+    acquire(&log.lock);
+    memset(log.freed[freed], 0, sizeof(log.freed[freed]));
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+    return;
   }
+
+  // Let the next transaction start while this one is written.
+  acquire(&log.lock);
+  log.committed = end;
+  log.writing = 1;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  if (end > start) {
+    write_log(start, end);  // Write modified blocks to log
+    write_head(end);        // Write header to disk -- the real commit
+  }
+
+  acquire(&log.lock);
+  memset(log.freed[freed], 0, sizeof(log.freed[freed]));
+  log.writing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will do the disk write, and the pin
+// stays until checkpoint() writes the block home.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -221,7 +410,7 @@ log_write(struct buf *b)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
+  for (i = log.committed; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
@@ -232,3 +421,39 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Record that the current transaction freed block blockno.
+// Called by bfree().
+void
+log_freed(uint blockno)
+{
+  if (blockno >= FSSIZE)
+    panic("log_freed");
+  if (log.outstanding < 1)
+    panic("log_freed outside of trans");
+
+  acquire(&log.lock);
+  log.freed[log.curfreed][blockno/32] |= 1 << (blockno%32);
+  release(&log.lock);
+}
+
+// Is block blockno in the log, committed or not, or freed by
+// a transaction not yet on disk?  Either way, writing it in
+// place now could clobber data a crash would bring back.
+int
+inlog(uint blockno)
+{
+  int i, r;
+
+  acquire(&log.lock);
+  r = 0;
+  if (blockno < FSSIZE)
+    for (i = 0; i < 2; i++)
+      if (log.freed[i][blockno/32] & (1 << (blockno%32)))
+        r = 1;
+  for (i = 0; !r && i < log.lh.n; i++) {
+    if (log.lh.block[i] == blockno)
+      r = 1;
+  }
+  release(&log.lock);
+  return r;
+}
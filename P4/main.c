@@ -30,9 +30,9 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
-  ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  ideinit();       // disk; the RAM disk needs kinit2()
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
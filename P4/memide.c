@@ -1,9 +1,17 @@
-// Fake IDE disk; stores blocks in memory.
-// Useful for running kernel without scratch disk.
+// RAM disk; stores blocks in kalloc'd pages.
+// Useful for running kernel without scratch disk, and for
+// measuring the file system without the cost of the disk.
+//
+// At boot the RAM disk is loaded from IDE disk 1 if there is
+// one, otherwise from the fs.img linked into the kernel, and
+// is sized to fit the image.  Reads do not copy: iderw()
+// points the buf at the block's bytes in the RAM disk, so a
+// cache miss costs no more than a hit.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
@@ -12,17 +20,127 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+
+#define IDE_BSY       0x80
+#define IDE_DRDY      0x40
+#define IDE_DF        0x20
+#define IDE_ERR       0x01
+
+#define IDE_CMD_READ  0x20
+
+#define BPP      (PGSIZE/BSIZE)  // blocks per page
+#define RAMPAGES 1024            // max pages; a 4MB RAM disk
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
 static int disksize;
-static uchar *memdisk;
+static uchar *ram[RAMPAGES];
+static struct iostat memstats;
+
+// Wait for IDE disk to become ready.
+static int
+idewait(int checkerr)
+{
+  int r;
+
+  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+    ;
+  if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
+    return -1;
+  return 0;
+}
+
+// Read n sectors starting at sector from disk 1 into dst,
+// polling rather than taking interrupts.
+static int
+pioread(uint sector, uchar *dst, int n)
+{
+  int i;
+
+  idewait(0);
+  outb(0x1f2, n);
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | (1<<4) | ((sector>>24)&0x0f));
+  outb(0x1f7, IDE_CMD_READ);
+  for(i = 0; i < n; i++){
+    if(idewait(1) < 0)
+      return -1;
+    insl(0x1f0, dst + i*BSIZE, BSIZE/4);
+  }
+  return 0;
+}
+
+// Is IDE disk 1 present?
+static int
+havedisk1(void)
+{
+  int i;
+
+  idewait(0);
+  outb(0x1f6, 0xe0 | (1<<4));
+  for(i=0; i<1000; i++){
+    if(inb(0x1f7) != 0)
+      return 1;
+  }
+  return 0;
+}
 
+// Allocate and zero pages for n blocks.
+static void
+ramalloc(int n)
+{
+  int i;
+
+  if(n <= 0 || n > RAMPAGES*BPP)
+    panic("ideinit: bad disk size");
+  disksize = n;
+  for(i = 0; i < (n + BPP-1)/BPP; i++){
+    if((ram[i] = (uchar*)kalloc()) == 0)
+      panic("ideinit: out of memory");
+    memset(ram[i], 0, PGSIZE);
+  }
+}
+
+static uchar*
+ramblock(uint blockno)
+{
+  return ram[blockno/BPP] + (blockno%BPP)*BSIZE;
+}
+
+// Must run after kinit2(), since the disk comes from kalloc().
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  struct superblock sb;
+  uchar *tmp;
+  int i, n;
+
+  outb(0x3f6, 0x02);  // the disk is polled, never interrupts
+  if(havedisk1()){
+    // The superblock gives the size of the file system.
+    if((tmp = (uchar*)kalloc()) == 0)
+      panic("ideinit: out of memory");
+    if(pioread(1, tmp, 1) < 0)
+      panic("ideinit: read superblock");
+    memmove(&sb, tmp, sizeof(sb));
+    kfree((char*)tmp);
+    ramalloc(sb.size);
+    for(i = 0; i < disksize; i += n){
+      n = disksize - i < BPP ? disksize - i : BPP;
+      if(pioread(i, ramblock(i), n) < 0)
+        panic("ideinit: read disk 1");
+    }
+    cprintf("ramdisk: %d blocks from disk 1\n", disksize);
+  } else {
+    ramalloc((uint)_binary_fs_img_size/BSIZE);
+    for(i = 0; i < disksize; i++)
+      memmove(ramblock(i), _binary_fs_img_start + i*BSIZE, BSIZE);
+    cprintf("ramdisk: %d blocks from kernel image\n", disksize);
+  }
+  outb(0x1f6, 0xe0 | (0<<4));
 }
 
 // Interrupt handler.
@@ -35,6 +153,8 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Either way the buf is left pointing at the block in the RAM
+// disk, so later writes to it need no copy.
 void
 iderw(struct buf *b)
 {
@@ -49,12 +169,35 @@ iderw(struct buf *b)
   if(b->blockno >= disksize)
     panic("iderw: block out of range");
 
-  p = memdisk + b->blockno*BSIZE;
+  p = ramblock(b->blockno);
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
-  } else
-    memmove(b->data, p, BSIZE);
+    if(b->data != p)
+      memmove(p, b->data, BSIZE);
+  }
+  b->data = p;
   b->flags |= B_VALID;
+  memstats.nreq++;
+  memstats.ncmd++;
+}
+
+// Sync n bufs with disk, one at a time.
+void
+iderwv(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bs[i]);
+}
+
+// Copy the request statistics for the memory disk into st.
+int
+idestat(int dev, struct iostat *st)
+{
+  if(dev != 1)
+    return -1;
+  *st = memstats;
+  return 0;
 }
@@ -16,13 +16,16 @@
 #endif
 
 #define NINODES 200
+#define ROOTBUCKETS 32  // hash index buckets in the root directory
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | inode bit map |
+//   free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nimap = NINODES/(BSIZE*8) + 1;
+int nlog = LOGSIZE + 1;  // Log header block and data blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -34,12 +37,14 @@ uint freeblock;
 
 
 void balloc(int);
+void imapwrite(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint dinum, char *name, uint inum);
 
 // convert to intel byte order
 ushort
@@ -69,15 +74,26 @@ main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
-  struct dirent de;
   char buf[BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    if(nlog < 3*MAXOPBLOCKS || nlog > LOGSIZE){
+      fprintf(stderr, "mkfs: log size must be %d to %d blocks\n",
+              3*MAXOPBLOCKS, LOGSIZE);
+      exit(1);
+    }
+    nlog++;
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
     exit(1);
   }
 
@@ -91,7 +107,7 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + nlog + ninodeblocks + nimap + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.size = xint(FSSIZE);
@@ -100,10 +116,11 @@ main(int argc, char *argv[])
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.imapstart = xint(2+nlog+ninodeblocks);
+  sb.bmapstart = xint(2+nlog+ninodeblocks+nimap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode map blocks %u, bitmap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nimap, nbitmap, nblocks, FSSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -117,15 +134,15 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  // Give the root directory a hash index.
+  rinode(rootino, &din);
+  din.minor = xshort(ROOTBUCKETS);
+  winode(rootino, &din);
+  for(i = 0; i < ROOTBUCKETS; i++)
+    iappend(rootino, zeroes, BSIZE);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirappend(rootino, ".", rootino);
+  dirappend(rootino, "..", rootino);
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -143,11 +160,7 @@ main(int argc, char *argv[])
       ++argv[i];
 
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, argv[i], inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -158,11 +171,12 @@ main(int argc, char *argv[])
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  off = ((off + BSIZE - 1)/BSIZE) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
 
   balloc(freeblock);
+  imapwrite(freeinode);
 
   exit(0);
 }
@@ -250,8 +264,62 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
+void
+imapwrite(int used)
+{
+  uchar buf[BSIZE];
+  int i;
+
+  printf("imapwrite: first %d inodes have been allocated\n", used);
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
+  for(i = 0; i < used; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
+  printf("imapwrite: write inode map block at sector %d\n", sb.imapstart);
+  wsect(sb.imapstart, buf);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the sector holding block fbn of inode din,
+// allocating it and any indirect blocks if needed.
+uint
+bmapsect(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint x, bn, nb;
+  int level;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    return xint(din->addrs[fbn]);
+  }
+
+  // Find the indirect tree holding fbn, then walk down it.
+  bn = fbn - NDIRECT;
+  for(level = 1, nb = NINDIRECT; bn >= nb; level++, nb *= NINDIRECT)
+    bn -= nb;
+  if(xint(din->addrs[NDIRECT+level-1]) == 0){
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  }
+  x = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--){
+    nb /= NINDIRECT;
+    rsect(x, (char*)indirect);
+    if(indirect[bn/nb] == 0){
+      indirect[bn/nb] = xint(freeblock++);
+      wsect(x, (char*)indirect);
+    }
+    x = xint(indirect[bn/nb]);
+    bn %= nb;
+  }
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +327,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,23 +334,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmapsect(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -295,3 +346,34 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Add the entry (name, inum) to directory dinum: to its hash
+// bucket if the directory has an index and there is room,
+// else at the end.
+void
+dirappend(uint dinum, char *name, uint inum)
+{
+  struct dinode din;
+  struct dirent de[BSIZE/sizeof(struct dirent)];
+  uint x, nbucket;
+  int i;
+
+  rinode(dinum, &din);
+  if((nbucket = xshort(din.minor)) > 0){
+    x = bmapsect(&din, dirhash(name) % nbucket);
+    rsect(x, (char*)de);
+    for(i = 0; i < BSIZE/sizeof(struct dirent); i++){
+      if(de[i].inum == 0){
+        de[i].inum = xshort(inum);
+        strncpy(de[i].name, name, DIRSIZ);
+        wsect(x, (char*)de);
+        return;
+      }
+    }
+  }
+
+  bzero(de, sizeof(de[0]));
+  de[0].inum = xshort(inum);
+  strncpy(de[0].name, name, DIRSIZ);
+  iappend(dinum, &de[0], sizeof(de[0]));
+}
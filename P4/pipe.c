@@ -7,18 +7,57 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+// The buffer is a ring of pages, a power of two of them so
+// that nread and nwrite can wrap around.  fcntl(F_SETPIPE_SZ)
+// resizes it.
+#define PIPEPAGES    4   // pages in a new pipe's buffer
+#define PIPEMAXPAGES 16  // most pages in a pipe's buffer
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEMAXPAGES];
+  uint size;      // bytes in buffer, npages*PGSIZE
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // readers sleeping on nread
+  int wwait;      // writers sleeping on nwrite
+  int rbusy;      // a splice is writing out unread bytes
+  int wbusy;      // a splice is filling reserved space
 };
 
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEMAXPAGES; i++)
+    if(p->data[i])
+      kfree(p->data[i]);
+  kfree((char*)p);
+}
+
+// Allocate npages of buffer into data.
+static int
+pipepages(char **data, int npages)
+{
+  int i;
+
+  memset(data, 0, PIPEMAXPAGES*sizeof(data[0]));
+  for(i = 0; i < npages; i++){
+    if((data[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(data[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,25 +69,37 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if(pipepages(p->data, PIPEPAGES) < 0){
+    kfree((char*)p);
+    p = 0;
+    goto bad;
+  }
+  p->size = PIPEPAGES*PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->rwait = 0;
+  p->wwait = 0;
+  p->rbusy = 0;
+  p->wbusy = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = p;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = p;
   return 0;
 
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,53 +120,299 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
-  } else
+    pipefree(p);
+  } else {
     release(&p->lock);
+    pollwakeup();
+  }
+}
+
+// Copy n bytes between addr and the ring at byte offset off,
+// into the ring if write.  One memmove per page touched.
+static void
+pipecopy(struct pipe *p, uint off, char *addr, int n, int write)
+{
+  char *q;
+  int m;
+
+  while(n > 0){
+    off %= p->size;
+    q = p->data[off/PGSIZE] + off%PGSIZE;
+    m = PGSIZE - off%PGSIZE;
+    if(m > n)
+      m = n;
+    if(write)
+      memmove(q, addr, m);
+    else
+      memmove(addr, q, m);
+    off += m;
+    addr += m;
+    n -= m;
+  }
 }
 
 //PAGEBREAK: 40
+// Write n bytes to p, waiting for room unless nonblock, in
+// which case write what fits, or return -EAGAIN if nothing does.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->wbusy || p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      if(nonblock){
+        if(p->rwait)
+          wakeup(&p->nread);
+        release(&p->lock);
+        pollwakeup();
+        return i > 0 ? i : -EAGAIN;
+      }
+      if(p->rwait)
+        wakeup(&p->nread);
+      release(&p->lock);
+      pollwakeup();
+      acquire(&p->lock);
+      if(!p->wbusy && p->nwrite != p->nread + p->size)
+        continue;
+      p->wwait++;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->wwait--;
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = p->nread + p->size - p->nwrite;
+    if(m > n - i)
+      m = n - i;
+    pipecopy(p, p->nwrite, addr + i, m, 1);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  if(p->rwait)
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
+  pollwakeup();
   return n;
 }
 
+// Read up to n bytes from p, waiting for some unless nonblock,
+// in which case return -EAGAIN if there are none.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int m;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
+    if(nonblock){
+      release(&p->lock);
+      return -EAGAIN;
+    }
+    p->rwait++;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->rwait--;
+  }
+  m = p->nwrite - p->nread;  //DOC: piperead-copy
+  if(m > n)
+    m = n;
+  pipecopy(p, p->nread, addr, m, 0);
+  p->nread += m;
+  if(p->wwait)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  release(&p->lock);
+  pollwakeup();
+  return m;
+}
+
+// Return the size of p's buffer.
+int
+pipegetsize(struct pipe *p)
+{
+  int n;
+
+  acquire(&p->lock);
+  n = p->size;
+  release(&p->lock);
+  return n;
+}
+
+// Resize p's buffer to the smallest power of two pages
+// holding n bytes.  Fails if that is too big, or too small
+// for what is buffered, or if a splice is using the ring.
+// Returns the new size.
+int
+pipesetsize(struct pipe *p, int n)
+{
+  char *data[PIPEMAXPAGES];
+  int i, npages, len, off;
+
+  if(n <= 0)
+    return -1;
+  for(npages = 1; npages*PGSIZE < n; npages *= 2)
+    if(npages == PIPEMAXPAGES)
+      return -1;
+  if(pipepages(data, npages) < 0)
+    return -1;
+
+  acquire(&p->lock);
+  len = p->nwrite - p->nread;
+  if(len > npages*PGSIZE || p->rbusy || p->wbusy){
+    release(&p->lock);
+    for(i = 0; i < npages; i++)
+      kfree(data[i]);
+    return -1;
+  }
+  // Move the buffered bytes to the start of the new ring.
+  for(off = 0; off < len; off += PGSIZE)
+    pipecopy(p, p->nread + off, data[off/PGSIZE],
+             len - off < PGSIZE ? len - off : PGSIZE, 0);
+  for(i = 0; i < PIPEMAXPAGES; i++){
+    if(p->data[i])
+      kfree(p->data[i]);
+    p->data[i] = data[i];
+  }
+  p->size = npages*PGSIZE;
+  p->nread = 0;
+  p->nwrite = len;
+  if(p->wwait)
+    wakeup(&p->nwrite);
+  release(&p->lock);
+  pollwakeup();
+  return npages*PGSIZE;
+}
+
+// Return the poll events ready on p's read end, or on its
+// write end if writable.  While a splice holds one side, that
+// side is not ready, just as a non-blocking read or write
+// there would fail; pipecommit() and pipeconsume() wake
+// pollers when it lets go.
+int
+pipepoll(struct pipe *p, int writable)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writable){
+    if(p->readopen == 0)
+      r |= POLLHUP;
+    else if(!p->wbusy && p->nwrite != p->nread + p->size)
+      r |= POLLOUT;
+  } else if(!p->rbusy){
+    if(p->nread != p->nwrite)
+      r |= POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLIN|POLLHUP;  // read returns 0
+  }
+  release(&p->lock);
+  return r;
+}
+
+// Splicing.  filesplice() moves data between a pipe and
+// another file through the ring itself.  A splice into p
+// reserves free space with pipereserve(), has the other file
+// read straight into it, and adds what arrived with
+// pipecommit().  A splice out of p takes unread bytes with
+// pipepeek(), has the other file write them straight from the
+// ring, and drops what was taken with pipeconsume().  The copy
+// runs without p->lock; meanwhile wbusy (rbusy) holds off
+// other writers (readers), so the bytes stay put.  None of
+// these sleep: a splice waits, with nothing held, until poll
+// says both sides are ready, so one blocked splice cannot
+// stall other users of the pipe.
+
+// Reserve up to n bytes of free space in p for a splice,
+// contiguous within a page.  Sets *addr to the space and
+// returns its length, or -EAGAIN if p is full or another
+// splice holds it, or -1 if the read end is closed.
+int
+pipereserve(struct pipe *p, char **addr, int n)
+{
+  uint off;
+  int m;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  if(p->wbusy || p->nwrite == p->nread + p->size){
+    release(&p->lock);
+    return -EAGAIN;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  off = p->nwrite % p->size;
+  m = p->nread + p->size - p->nwrite;
+  if(m > PGSIZE - off%PGSIZE)
+    m = PGSIZE - off%PGSIZE;
+  if(m > n)
+    m = n;
+  *addr = p->data[off/PGSIZE] + off%PGSIZE;
+  p->wbusy = 1;
+  release(&p->lock);
+  return m;
+}
+
+// End a splice into p, adding the first n reserved bytes.
+void
+pipecommit(struct pipe *p, int n)
+{
+  acquire(&p->lock);
+  p->nwrite += n;
+  p->wbusy = 0;
+  if(p->wwait)
+    wakeup(&p->nwrite);
+  if(p->rwait)
+    wakeup(&p->nread);
+  release(&p->lock);
+  pollwakeup();
+}
+
+// Take up to n unread bytes of p for a splice, contiguous
+// within a page.  Sets *addr to them and returns how many:
+// 0 at end of file, or -EAGAIN if p is empty or another
+// splice holds it.
+int
+pipepeek(struct pipe *p, char **addr, int n)
+{
+  uint off;
+  int m;
+
+  acquire(&p->lock);
+  if(p->rbusy || (p->nread == p->nwrite && p->writeopen)){
+    release(&p->lock);
+    return -EAGAIN;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  off = p->nread % p->size;
+  m = p->nwrite - p->nread;
+  if(m > PGSIZE - off%PGSIZE)
+    m = PGSIZE - off%PGSIZE;
+  if(m > n)
+    m = n;
+  *addr = p->data[off/PGSIZE] + off%PGSIZE;
+  if(m > 0)
+    p->rbusy = 1;
+  release(&p->lock);
+  return m;
+}
+
+// End a splice out of p that pipepeek() gave bytes to,
+// dropping the first n of them.
+void
+pipeconsume(struct pipe *p, int n)
+{
+  acquire(&p->lock);
+  p->nread += n;
+  p->rbusy = 0;
+  if(p->wwait)
+    wakeup(&p->nwrite);
+  if(p->rwait)
+    wakeup(&p->nread);
   release(&p->lock);
-  return i;
+  pollwakeup();
 }
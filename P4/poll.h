@@ -0,0 +1,13 @@
+// poll() request and result for one fd.
+struct pollfd {
+  int fd;         // file descriptor
+  short events;   // events to wait for
+  short revents;  // events that happened
+};
+
+#define POLLIN   0x001  // data to read
+#define POLLOUT  0x004  // room to write
+#define POLLHUP  0x010  // other end closed; always reported
+#define POLLNVAL 0x020  // fd not open; always reported
+
+#define NPOLLFD  64  // most fds in one poll()
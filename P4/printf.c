@@ -2,14 +2,27 @@
 #include "stat.h"
 #include "user.h"
 
+// printf() collects its output here and hands it to
+// bufwrite() in pieces, so even an unbuffered fd gets one
+// write() per call rather than one per character.
+struct out {
+  int fd;
+  int n;
+  char buf[64];
+};
+
 static void
-putc(int fd, char c)
+putc(struct out *o, char c)
 {
-  write(fd, &c, 1);
+  if(o->n == sizeof(o->buf)){
+    bufwrite(o->fd, o->buf, o->n);
+    o->n = 0;
+  }
+  o->buf[o->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -32,7 +45,7 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(o, buf[i]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
@@ -42,7 +55,11 @@ printf(int fd, char *fmt, ...)
   char *s;
   int c, i, state;
   uint *ap;
+  struct out out, *o;
 
+  o = &out;
+  o->fd = fd;
+  o->n = 0;
   state = 0;
   ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
@@ -51,14 +68,14 @@ printf(int fd, char *fmt, ...)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(o, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(o, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -66,20 +83,21 @@ printf(int fd, char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(o, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(o, '%');
+        putc(o, c);
       }
       state = 0;
     }
   }
+  bufwrite(fd, o->buf, o->n);
 }
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "trace.h"
 #ifdef CS333_P2
 #include "uproc.h"
 #endif //CS333_P2
@@ -45,6 +46,23 @@ static struct {
 
 static struct proc *initproc;
 
+// Ring of trace records for a traced process, in one kalloc'd
+// page.  The process appends to it in tracelog(); the pointer
+// in struct proc changes only under ptable.lock, which
+// traceread() holds while draining.
+struct tracebuf {
+  struct spinlock lock;   // protects head and tail
+  uint mask[NTRACEMASK];  // SYS_ numbers to record, bit per call
+  uint head;              // oldest unread record
+  uint tail;              // next free record
+  struct tracerec rec[];
+};
+
+#define NTRACEREC ((PGSIZE - sizeof(struct tracebuf)) / sizeof(struct tracerec))
+
+static struct tracebuf* tracealloc(uint*);
+static void tracefree(struct proc*);
+
 uint nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
@@ -158,6 +176,8 @@ allocproc(void)
   p->context = (struct context*)sp;
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
+  p->ioring = 0;
+  p->trace = 0;
   p->start_ticks = ticks;
   p->cpu_ticks_total = 0;
   p->cpu_ticks_in = 0;
@@ -205,6 +225,8 @@ allocproc(void)
   p->context = (struct context*)sp;
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
+  p->ioring = 0;
+  p->trace = 0;
 #ifdef CS333_P1
   p->start_ticks = ticks;
 #endif // CS333_P1
@@ -304,6 +326,7 @@ fork(void)
   int i;
   uint pid;
   struct proc *np;
+  struct tracebuf *tb;
   struct proc *curproc = myproc();
 
   // Allocate process.
@@ -344,12 +367,15 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->ioring = curproc->ioring;  // same address in the copy
+  tb = curproc->trace ? tracealloc(curproc->trace->mask) : 0;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   pid = np->pid;
 
   acquire(&ptable.lock);
+  np->trace = tb;  // published under the lock for traceread()
 #ifdef CS333_P3
   int rc = stateListRemove(&ptable.list[EMBRYO], np);
   if(rc == -1)
@@ -394,7 +420,7 @@ exit(void)
     }
   }
 
-  begin_op();
+  begin_opn(opblocks(1, 0));
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -487,7 +513,7 @@ exit(void)
     }
   }
 
-  begin_op();
+  begin_opn(opblocks(1, 0));
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -581,6 +607,7 @@ int wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
+        tracefree(p);
         freevm(p->pgdir);
         p->pid = 0;
         p->parent = 0;
@@ -626,6 +653,7 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
+        tracefree(p);
         freevm(p->pgdir);
         p->pid = 0;
         p->parent = 0;
@@ -911,9 +939,11 @@ forkret(void)
     // Some initialization functions must be run in the context
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
+    // The log is recovered first so that iinit sees the
+    // final free block bitmap.
     first = 0;
-    iinit(ROOTDEV);
     initlog(ROOTDEV);
+    iinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -1575,3 +1605,111 @@ getpriority(int pid)
   return -1;
 }
 #endif // CS333_P4
+
+// Allocate a trace ring that records the calls in mask.
+static struct tracebuf*
+tracealloc(uint *mask)
+{
+  struct tracebuf *tb;
+
+  if((tb = (struct tracebuf*)kalloc()) == 0)
+    return 0;
+  initlock(&tb->lock, "trace");
+  memmove(tb->mask, mask, sizeof(tb->mask));
+  tb->head = tb->tail = 0;
+  return tb;
+}
+
+// Free p's trace ring.  Caller holds ptable.lock, or p is
+// the current process.
+static void
+tracefree(struct proc *p)
+{
+  struct tracebuf *tb;
+
+  if((tb = p->trace) == 0)
+    return;
+  p->trace = 0;
+  kfree((char*)tb);
+}
+
+// Record the system calls set in mask, NTRACEMASK words, from
+// now on and in children forked from now on.  An empty mask
+// stops tracing and discards records not yet read.
+int
+trace(uint *mask)
+{
+  struct proc *curproc = myproc();
+  struct tracebuf *tb;
+  int i;
+  uint any;
+
+  any = 0;
+  for(i = 0; i < NTRACEMASK; i++)
+    any |= mask[i];
+
+  acquire(&ptable.lock);
+  if(!any){
+    tracefree(curproc);
+  } else if(curproc->trace){
+    memmove(curproc->trace->mask, mask, sizeof(curproc->trace->mask));
+  } else {
+    release(&ptable.lock);
+    if((tb = tracealloc(mask)) == 0)
+      return -1;
+    acquire(&ptable.lock);
+    curproc->trace = tb;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Append r to the current process's trace ring if its call
+// is being traced, replacing the oldest record if full.
+void
+tracelog(struct tracerec *r)
+{
+  struct tracebuf *tb;
+
+  tb = myproc()->trace;
+  if(tb == 0 || r->num < 0 || r->num >= 32*NTRACEMASK)
+    return;
+  if(!(tb->mask[r->num/32] & (1 << r->num%32)))
+    return;
+  acquire(&tb->lock);
+  tb->rec[tb->tail++ % NTRACEREC] = *r;
+  if(tb->tail - tb->head > NTRACEREC)
+    tb->head++;
+  release(&tb->lock);
+}
+
+// Move up to n of process pid's trace records into dst, oldest
+// first.  The caller must be pid or its parent.  Returns the
+// number moved, or -1 if pid is not traced, or has exited
+// and has no records left.
+int
+traceread(int pid, struct tracerec *dst, int n)
+{
+  struct proc *p;
+  struct proc *curproc = myproc();
+  struct tracebuf *tb;
+  int i;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->pid != pid)
+      continue;
+    if((p != curproc && p->parent != curproc) || (tb = p->trace) == 0)
+      break;
+    acquire(&tb->lock);
+    for(i = 0; i < n && tb->head != tb->tail; i++)
+      dst[i] = tb->rec[tb->head++ % NTRACEREC];
+    release(&tb->lock);
+    if(i == 0 && p->state == ZOMBIE)
+      break;
+    release(&ptable.lock);
+    return i;
+  }
+  release(&ptable.lock);
+  return -1;
+}
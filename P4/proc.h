@@ -49,6 +49,9 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int logreserved;             // Log blocks reserved by begin_op
+  struct ioring *ioring;       // Registered system call ring (user address)
+  struct tracebuf *trace;      // System call trace ring, if tracing
 #ifdef CS333_P1
   uint start_ticks;            // For control - p
 #endif // CS333_P1
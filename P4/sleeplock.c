@@ -16,31 +16,107 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  memset(lk->rpid, 0, sizeof(lk->rpid));
+  lk->runtracked = 0;
+  lk->writers = 0;
   lk->pid = 0;
 }
 
+// Count the current process as a shared holder of lk,
+// recording its pid if there is a free slot.
+// Caller must hold lk->lk.
+static void
+addreader(struct sleeplock *lk)
+{
+  int i;
+
+  lk->readers++;
+  for (i = 0; i < NSHARERS; i++) {
+    if (lk->rpid[i] == 0) {
+      lk->rpid[i] = myproc()->pid;
+      return;
+    }
+  }
+  lk->runtracked++;
+}
+
+// Drop the current process as a shared holder of lk.
+// Caller must hold lk->lk.
+static void
+dropreader(struct sleeplock *lk)
+{
+  int i;
+
+  lk->readers--;
+  for (i = 0; i < NSHARERS; i++) {
+    if (lk->rpid[i] == myproc()->pid) {
+      lk->rpid[i] = 0;
+      return;
+    }
+  }
+  if (lk->runtracked == 0)
+    panic("releasesleep: not a holder");
+  lk->runtracked--;
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->writers++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers.  New readers wait
+// while a writer is waiting, so writers are not starved.
 void
-releasesleep(struct sleeplock *lk)
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->writers) {
+    sleep(lk, &lk->lk);
+  }
+  addreader(lk);
+  release(&lk->lk);
+}
+
+// Turn an exclusive hold of lk into a shared one, letting
+// waiting readers in.
+void
+downgradesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  addreader(lk);
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Release lk, held either exclusively or shared.
+void
+releasesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if (lk->locked) {
+    lk->locked = 0;
+    lk->pid = 0;
+    wakeup(lk);
+  } else {
+    dropreader(lk);
+    if (lk->readers == 0)
+      wakeup(lk);
+  }
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -52,5 +128,22 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Does the current process hold lk shared?  Once more than
+// NSHARERS processes share lk, one without a slot cannot be
+// told from a process not holding it, and the answer is yes.
+int
+holdingsleepshared(struct sleeplock *lk)
+{
+  int i, r;
+
+  acquire(&lk->lk);
+  r = lk->runtracked > 0;
+  for (i = 0; i < NSHARERS; i++)
+    if (lk->rpid[i] == myproc()->pid)
+      r = 1;
+  release(&lk->lk);
+  return r;
+}
+
 
 
@@ -1,6 +1,12 @@
+#define NSHARERS 4   // shared holders a sleeplock tracks by pid
+
 // Long-term locks for processes
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int rpid[NSHARERS]; // Pids of shared holders; 0 if slot free
+  int runtracked;    // Shared holders with no slot in rpid
+  int writers;       // Number waiting for exclusive use
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
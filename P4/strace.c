@@ -0,0 +1,113 @@
+#include "types.h"
+#include "user.h"
+#include "syscall.h"
+#include "trace.h"
+
+#define NREC 32
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+static char *names[] = {
+[SYS_fork]     "fork",
+[SYS_exit]     "exit",
+[SYS_wait]     "wait",
+[SYS_pipe]     "pipe",
+[SYS_read]     "read",
+[SYS_kill]     "kill",
+[SYS_exec]     "exec",
+[SYS_fstat]    "fstat",
+[SYS_chdir]    "chdir",
+[SYS_dup]      "dup",
+[SYS_getpid]   "getpid",
+[SYS_sbrk]     "sbrk",
+[SYS_sleep]    "sleep",
+[SYS_uptime]   "uptime",
+[SYS_open]     "open",
+[SYS_write]    "write",
+[SYS_mknod]    "mknod",
+[SYS_unlink]   "unlink",
+[SYS_link]     "link",
+[SYS_mkdir]    "mkdir",
+[SYS_close]    "close",
+[SYS_halt]     "halt",
+[SYS_date]     "date",
+[SYS_getuid]   "getuid",
+[SYS_getgid]   "getgid",
+[SYS_getppid]  "getppid",
+[SYS_setuid]   "setuid",
+[SYS_setgid]   "setgid",
+[SYS_getprocs] "getprocs",
+[SYS_setpriority] "setpriority",
+[SYS_getpriority] "getpriority",
+[SYS_iostat]   "iostat",
+[SYS_fallocate] "fallocate",
+[SYS_fcntl]    "fcntl",
+[SYS_splice]   "splice",
+[SYS_readv]    "readv",
+[SYS_writev]   "writev",
+[SYS_lseek]    "lseek",
+[SYS_pread]    "pread",
+[SYS_pwrite]   "pwrite",
+[SYS_poll]     "poll",
+[SYS_ioring_setup] "ioring_setup",
+[SYS_ioring_enter] "ioring_enter",
+[SYS_trace]    "trace",
+[SYS_traceread] "traceread",
+};
+
+static struct tracerec rec[NREC];
+
+// Run a command, printing each system call it makes on
+// stderr as it goes: the call, its first three arguments,
+// what it returned, and its time in Kcycles.  Calls that do
+// not return, such as exit, are not shown.
+int
+main(int argc, char *argv[])
+{
+  uint mask[NTRACEMASK], none[NTRACEMASK];
+  int i, n, pid;
+  char *name;
+
+  if(argc < 2){
+    printf(2, "usage: strace command [arg ...]\n");
+    exit();
+  }
+
+  // Trace across the fork, so the child is traced from its
+  // first call on, then stop tracing ourselves.
+  for(i = 0; i < NTRACEMASK; i++){
+    mask[i] = ~0;
+    none[i] = 0;
+  }
+  if(trace(mask) < 0){
+    printf(2, "strace: trace failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    printf(2, "strace: exec %s failed\n", argv[1]);
+    exit();
+  }
+  trace(none);
+  if(pid < 0){
+    printf(2, "strace: fork failed\n");
+    exit();
+  }
+
+  while((n = traceread(pid, rec, NREC)) >= 0){
+    if(n == 0){
+      sleep(1);
+      continue;
+    }
+    for(i = 0; i < n; i++){
+      name = rec[i].num < NELEM(names) ? names[rec[i].num] : 0;
+      if(name == 0)
+        name = "?";
+      printf(2, "%d %s(%x, %x, %x) = %d  %dK\n", pid, name,
+             rec[i].args[0], rec[i].args[1], rec[i].args[2],
+             rec[i].ret, rec[i].cycles >> 10);
+    }
+  }
+  wait();
+  exit();
+}
@@ -6,6 +6,8 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "ioring.h"
+#include "trace.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -121,6 +123,20 @@ extern int sys_getprocs(void);
 extern int sys_setpriority(void);
 extern int sys_getpriority(void);
 #endif // CS333_P4
+extern int sys_iostat(void);
+extern int sys_fallocate(void);
+extern int sys_fcntl(void);
+extern int sys_splice(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_lseek(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_poll(void);
+static int sys_ioring_setup(void);
+static int sys_ioring_enter(void);
+extern int sys_trace(void);
+extern int sys_traceread(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]     sys_fork,
@@ -162,49 +178,41 @@ static int (*syscalls[])(void) = {
 [SYS_setpriority] sys_setpriority,
 [SYS_getpriority] sys_getpriority,
 #endif
+[SYS_iostat]   sys_iostat,
+[SYS_fallocate] sys_fallocate,
+[SYS_fcntl]    sys_fcntl,
+[SYS_splice]   sys_splice,
+[SYS_readv]    sys_readv,
+[SYS_writev]   sys_writev,
+[SYS_lseek]    sys_lseek,
+[SYS_pread]    sys_pread,
+[SYS_pwrite]   sys_pwrite,
+[SYS_poll]     sys_poll,
+[SYS_ioring_setup] sys_ioring_setup,
+[SYS_ioring_enter] sys_ioring_enter,
+[SYS_trace]    sys_trace,
+[SYS_traceread] sys_traceread,
 };
 
-#if defined(CS333_P1) && defined(PRINT_SYSCALLS)
-static char *syscallnames[] = {
-  [SYS_fork]     "fork",
-  [SYS_exit]     "exit",
-  [SYS_wait]     "wait",
-  [SYS_pipe]     "pipe",
-  [SYS_read]     "read",
-  [SYS_kill]     "kill",
-  [SYS_exec]     "exec",
-  [SYS_fstat]    "fstat",
-  [SYS_chdir]    "chdir",
-  [SYS_dup]      "dup",
-  [SYS_getpid]   "getpid",
-  [SYS_sbrk]     "sbrk",
-  [SYS_sleep]    "sleep",
-  [SYS_uptime]   "uptime",
-  [SYS_open]     "open",
-  [SYS_write]    "write",
-  [SYS_mknod]    "mknod",
-  [SYS_unlink]   "unlink",
-  [SYS_link]     "link",
-  [SYS_mkdir]    "mkdir",
-  [SYS_close]    "close",
-#ifdef PDX_XV6
-  [SYS_halt]     "halt",
-#endif // PDX_XV6
-  [SYS_date]     "date",
-#ifdef CS333_P2
-  [SYS_getuid]   "getuid",
-  [SYS_getgid]   "getgid",
-  [SYS_getppid]  "getppid",
-  [SYS_setuid]   "setuid",
-  [SYS_setgid]   "setgid",
-  [SYS_getprocs] "getprocs".
-#endif // CS333_P2
-#ifdef CS333_P3
-  [SYS_setpriority] "setpriority"
-  [SYS_getpriority] "getpriority"
-#endif // CS333_P4
-};
-#endif // CS3333_P1 and PRINT_SYSCALLS
+// Run system call num for a process being traced, and log
+// it with tracelog().
+static int
+tracecall(int num)
+{
+  struct tracerec r;
+  unsigned long long t0;
+  int i;
+
+  r.num = num;
+  for(i = 0; i < NELEM(r.args); i++)
+    if(argint(i, &r.args[i]) < 0)
+      r.args[i] = 0;
+  t0 = rdtsc();
+  r.ret = syscalls[num]();
+  r.cycles = rdtsc() - t0;
+  tracelog(&r);
+  return r.ret;
+}
 
 void
 syscall(void)
@@ -214,13 +222,95 @@ syscall(void)
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    curproc->tf->eax = syscalls[num]();
-#if defined(CS333_P1) && defined(PRINT_SYSCALLS)
-    cprintf("%s -> %d\n", syscallnames[num], curproc->tf->eax);
-#endif // PRINT_SYSCALLS
+    if(curproc->trace == 0)
+      curproc->tf->eax = syscalls[num]();
+    else
+      curproc->tf->eax = tracecall(num);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
     curproc->tf->eax = -1;
   }
 }
+
+// System calls an ioring may run: those that neither replace
+// nor resize the address space holding the ring, nor block
+// for a child or a signal.
+static char ioringok[] = {
+[SYS_read]     1,
+[SYS_write]    1,
+[SYS_open]     1,
+[SYS_close]    1,
+[SYS_fstat]    1,
+[SYS_dup]      1,
+[SYS_link]     1,
+[SYS_unlink]   1,
+[SYS_mkdir]    1,
+[SYS_mknod]    1,
+[SYS_getpid]   1,
+[SYS_uptime]   1,
+[SYS_fallocate] 1,
+[SYS_fcntl]    1,
+[SYS_splice]   1,
+[SYS_readv]    1,
+[SYS_writev]   1,
+[SYS_lseek]    1,
+[SYS_pread]    1,
+[SYS_pwrite]   1,
+};
+
+// Register the struct ioring at the given user address.
+static int
+sys_ioring_setup(void)
+{
+  char *r;
+
+  if(argptr(0, &r, sizeof(struct ioring)) < 0 || (uint)r % 4 != 0)
+    return -1;
+  myproc()->ioring = (struct ioring*)r;
+  return 0;
+}
+
+// Run up to n submitted calls in order, posting each result,
+// and stop early if the completion ring is full.  Each call
+// finds its arguments through a trap frame %esp pointed at its
+// submission, as if the process had made it.  Returns the
+// number of calls run.
+static int
+sys_ioring_enter(void)
+{
+  struct proc *curproc = myproc();
+  struct ioring *r = curproc->ioring;
+  struct iosqe *sqe;
+  struct iocqe *cqe;
+  int n, i, num, user, ret;
+  uint esp;
+
+  if(argint(0, &n) < 0 || r == 0)
+    return -1;
+  if((uint)r + sizeof(*r) > curproc->sz)  // sbrk shrank it away
+    return -1;
+  esp = curproc->tf->esp;
+  for(i = 0; i < n && !curproc->killed; i++){
+    if(r->sqhead == r->sqtail || r->cqtail - r->cqhead >= IORING_SIZE)
+      break;
+    sqe = &r->sq[r->sqhead % IORING_SIZE];
+    num = sqe->num;
+    user = sqe->user;
+    if(num > 0 && num < NELEM(ioringok) && ioringok[num]){
+      curproc->tf->esp = (uint)sqe->args - 4;
+      if(curproc->trace == 0)
+        ret = syscalls[num]();
+      else
+        ret = tracecall(num);  // traced like a direct call
+      curproc->tf->esp = esp;
+    } else
+      ret = -1;
+    cqe = &r->cq[r->cqtail % IORING_SIZE];
+    cqe->user = user;
+    cqe->ret = ret;
+    r->cqtail++;
+    r->sqhead++;
+  }
+  return i;
+}
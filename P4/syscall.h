@@ -34,3 +34,18 @@
 // project 4
 #define SYS_setpriority SYS_getprocs+1
 #define SYS_getpriority SYS_setpriority+1
+// file system and I/O
+#define SYS_iostat   SYS_getpriority+1
+#define SYS_fallocate SYS_iostat+1
+#define SYS_fcntl    SYS_fallocate+1
+#define SYS_splice   SYS_fcntl+1
+#define SYS_readv    SYS_splice+1
+#define SYS_writev   SYS_readv+1
+#define SYS_lseek    SYS_writev+1
+#define SYS_pread    SYS_lseek+1
+#define SYS_pwrite   SYS_pread+1
+#define SYS_poll     SYS_pwrite+1
+#define SYS_ioring_setup SYS_poll+1
+#define SYS_ioring_enter SYS_ioring_setup+1
+#define SYS_trace    SYS_ioring_enter+1
+#define SYS_traceread SYS_trace+1
@@ -15,6 +15,14 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "iostat.h"
+#include "uio.h"
+#include "poll.h"
+
+// Log blocks dirlink() may write: the block the entry goes in
+// and, if that grows the directory, up to three indirect
+// blocks and the directory's inode.
+#define LINKBLOCKS 5
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -124,7 +132,8 @@ sys_link(void)
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  // Both lookups, and ip's link count.
+  begin_opn(opblocks(pathlen(old)+pathlen(new)+2, 1 + LINKBLOCKS));
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -168,14 +177,18 @@ bad:
 static int
 isdirempty(struct inode *dp)
 {
-  int off;
-  struct dirent de;
+  int off, n, i;
+  struct dirent de[BSIZE/sizeof(struct dirent)];
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+  // Read a block of entries at a time.  "." and ".." need not
+  // come first in a directory with a hash index.
+  for(off=0; off<dp->size; off+=n){
+    if((n = readi(dp, (char*)de, off, sizeof(de))) <= 0)
       panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
+    for(i=0; i<n/sizeof(de[0]); i++)
+      if(de[i].inum != 0 && namecmp(de[i].name, ".") != 0 &&
+         namecmp(de[i].name, "..") != 0)
+        return 0;
   }
   return 1;
 }
@@ -192,7 +205,8 @@ sys_unlink(void)
   if(argstr(0, &path) < 0)
     return -1;
 
-  begin_op();
+  // The entry's block and the two inodes.
+  begin_opn(opblocks(pathlen(path)+1, 3));
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -218,6 +232,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -238,6 +253,16 @@ bad:
   return -1;
 }
 
+// Log blocks to reserve for create(path, type): the lookup,
+// the new inode, its entry in the parent and, for a directory,
+// its first block and the parent's link count.
+static int
+createblocks(char *path, short type)
+{
+  return opblocks(pathlen(path)+1,
+                  1 + LINKBLOCKS + (type == T_DIR ? 2 : 0));
+}
+
 static struct inode*
 create(char *path, short type, short major, short minor)
 {
@@ -294,7 +319,10 @@ sys_open(void)
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  if(omode & O_CREATE)
+    begin_opn(createblocks(path, T_FILE));
+  else
+    begin_opn(opblocks(pathlen(path)+1, 0));
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -330,6 +358,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   return fd;
 }
 
@@ -339,8 +368,10 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, &path) < 0)
+    return -1;
+  begin_opn(createblocks(path, T_DIR));
+  if((ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -356,11 +387,12 @@ sys_mknod(void)
   char *path;
   int major, minor;
 
-  begin_op();
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
-     argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEV, major, minor)) == 0){
+     argint(2, &minor) < 0)
+    return -1;
+  begin_opn(createblocks(path, T_DEV));
+  if((ip = create(path, T_DEV, major, minor)) == 0){
     end_op();
     return -1;
   }
@@ -376,8 +408,11 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *curproc = myproc();
 
-  begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  if(argstr(0, &path) < 0)
+    return -1;
+  // The lookup, and the old working directory.
+  begin_opn(opblocks(pathlen(path)+2, 0));
+  if((ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -443,3 +478,192 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_iostat(void)
+{
+  int dev;
+  struct iostat *st;
+
+  if(argint(0, &dev) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return idestat(dev, st);
+}
+
+int
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  if(off < 0 || len < 0)
+    return -1;
+  return fileprealloc(f, off, len);
+}
+
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(cmd == F_GETPIPE_SZ || cmd == F_SETPIPE_SZ){
+    if(f->type != FD_PIPE)
+      return -1;
+    if(cmd == F_GETPIPE_SZ)
+      return pipegetsize(f->pipe);
+    return pipesetsize(f->pipe, arg);
+  }
+  if(cmd == F_GETFL){
+    if(f->readable && f->writable)
+      arg = O_RDWR;
+    else
+      arg = f->writable ? O_WRONLY : O_RDONLY;
+    return arg | (f->nonblock ? O_NONBLOCK : 0);
+  }
+  if(cmd == F_SETFL){
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+int
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
+
+// Fetch the iovec array that is argument n into iov, checking
+// each segment as argptr() would.  Returns the segment count.
+static int
+argiov(int n, struct iovec *iov)
+{
+  struct iovec *uiov;
+  int i, cnt;
+  uint tot;
+
+  if(argint(n+1, &cnt) < 0 || cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(argptr(n, (char**)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    tot += iov[i].iov_len;
+    if((int)iov[i].iov_len < 0 || (int)tot < 0 ||
+       (uint)iov[i].iov_base >= myproc()->sz ||
+       (uint)iov[i].iov_base + iov[i].iov_len > myproc()->sz)
+      return -1;
+  }
+  return cnt;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return filelseek(f, off, whence);
+}
+
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Wait until one of the n fds in fds is ready for the events
+// asked for, or until timeout ticks pass (forever if timeout is
+// negative).  Returns the number of fds with revents set.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f;
+  int i, n, timeout, nready;
+  uint seq, ticks0;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NPOLLFD ||
+     argptr(0, (char**)&fds, n*sizeof(*fds)) < 0 || argint(2, &timeout) < 0)
+    return -1;
+
+  seq = pollenter(timeout > 0);
+  ticks0 = ticks;
+  for(;;){
+    nready = 0;
+    for(i = 0; i < n; i++){
+      if(fds[i].fd < 0 || fds[i].fd >= NOFILE ||
+         (f = myproc()->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f) & (fds[i].events|POLLHUP);
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready || timeout == 0 || myproc()->killed ||
+       (timeout > 0 && ticks - ticks0 >= timeout))
+      break;
+    pollwait(&seq);
+  }
+  pollexit(timeout > 0);
+  if(myproc()->killed)
+    return -1;
+  return nready;
+}
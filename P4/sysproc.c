@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "trace.h"
 #ifdef PDX_XV6
 #include "pdx-kernel.h"
 #endif // PDX_XV6
@@ -193,3 +194,26 @@ sys_getpriority(void)
     return getpriority(pid);
 }
 #endif // CS333_P4
+
+int
+sys_trace(void)
+{
+  uint *mask;
+
+  if(argptr(0, (void*)&mask, NTRACEMASK*sizeof(uint)) < 0)
+    return -1;
+  return trace(mask);
+}
+
+int
+sys_traceread(void)
+{
+  int pid, n;
+  struct tracerec *dst;
+
+  if(argint(0, &pid) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(argptr(1, (void*)&dst, n*sizeof(*dst)) < 0)
+    return -1;
+  return traceread(pid, dst, n);
+}
@@ -0,0 +1,14 @@
+// System call tracing; see trace() and traceread() in proc.c.
+// A process traces the calls whose SYS_ numbers are set in its
+// mask, and fork() passes the mask on.  Each traced call leaves
+// a record in a per-process ring, and a reader drains it.
+// When the ring fills, new records replace the oldest.
+
+#define NTRACEMASK 2   // words of mask; covers SYS_ numbers < 64
+
+struct tracerec {
+  int num;      // SYS_ number
+  int args[3];  // first three argument words, as passed
+  int ret;      // return value
+  uint cycles;  // time in the call, in CPU cycles
+};
@@ -40,17 +40,26 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// System calls made with int $T_SYSCALL come here from trap().
+// Those made with sysenter come straight from sysentry in
+// trapasm.S, skipping the IDT, alltraps and trap().
+void
+systrap(struct trapframe *tf)
+{
+  if(myproc()->killed)
+    exit();
+  myproc()->tf = tf;
+  syscall();
+  if(myproc()->killed)
+    exit();
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
 {
   if(tf->trapno == T_SYSCALL){
-    if(myproc()->killed)
-      exit();
-    myproc()->tf = tf;
-    syscall();
-    if(myproc()->killed)
-      exit();
+    systrap(tf);
     return;
   }
 
@@ -66,6 +75,7 @@ trap(struct trapframe *tf)
       wakeup(&ticks);
       release(&tickslock);
 #endif // PDX_XV6
+      polltick();
     }
     lapiceoi();
     break;
@@ -0,0 +1,7 @@
+// Scatter-gather I/O segments, as passed to readv() and writev().
+struct iovec {
+  void *iov_base;  // start of segment
+  uint iov_len;    // bytes in segment
+};
+
+#define IOV_MAX 16  // most segments in one call
@@ -1,9 +1,16 @@
 #include "types.h"
 #include "stat.h"
 #include "fcntl.h"
+#include "param.h"
 #include "user.h"
 #include "x86.h"
 
+// System call stubs in usys.S that are wrapped below.
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+
 char*
 strcpy(char *s, char *t)
 {
@@ -55,6 +62,7 @@ gets(char *buf, int max)
   int i, cc;
   char c;
 
+  bufflushall();  // show any prompt before waiting for input
   for(i=0; i+1 < max; ){
     cc = read(0, &c, 1);
     if(cc < 1)
@@ -135,3 +143,128 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Buffered output.  An fd that bufmode() has made line or fully
+// buffered gets a buffer, from sbrk on its first buffered write,
+// that bufwrite() and printf() fill; it goes to write() when it
+// fills, or through the last newline in line-buffered mode.
+// Every fd starts unbuffered, so a program that does not ask
+// pays nothing and sees its output in the order it wrote it.
+// exit(), fork(), exec() and close() flush first, so output is
+// neither lost nor duplicated.
+#define UBUFSIZE 512
+
+static struct {
+  int mode;
+  int n;
+  char *buf;
+} ubuf[NOFILE];
+
+int
+bufflush(int fd)
+{
+  int n;
+
+  if(fd < 0 || fd >= NOFILE || ubuf[fd].n == 0)
+    return 0;
+  n = ubuf[fd].n;
+  ubuf[fd].n = 0;
+  if(write(fd, ubuf[fd].buf, n) != n)
+    return -1;
+  return 0;
+}
+
+void
+bufflushall(void)
+{
+  int fd;
+
+  for(fd = 0; fd < NOFILE; fd++)
+    bufflush(fd);
+}
+
+int
+bufmode(int fd, int mode)
+{
+  if(fd < 0 || fd >= NOFILE || mode < BUF_NONE || mode > BUF_FULL)
+    return -1;
+  if(bufflush(fd) < 0)
+    return -1;
+  ubuf[fd].mode = mode;
+  return 0;
+}
+
+int
+bufwrite(int fd, void *vp, int n)
+{
+  char *p = vp;
+  int m;
+
+  if(fd < 0 || fd >= NOFILE || ubuf[fd].mode == BUF_NONE)
+    return write(fd, p, n);
+  if(ubuf[fd].buf == 0){
+    // sbrk rather than malloc, which forktest does not link.
+    if((ubuf[fd].buf = sbrk(UBUFSIZE)) == (char*)-1){
+      ubuf[fd].buf = 0;
+      return write(fd, p, n);
+    }
+  }
+
+  // The first m bytes go out now: through the last newline
+  // when line buffered, or all of them if the rest won't fit.
+  m = 0;
+  if(ubuf[fd].mode == BUF_LINE)
+    for(m = n; m > 0 && p[m-1] != '\n'; m--)
+      ;
+  if(ubuf[fd].n + n - m > UBUFSIZE)
+    m = n;
+  if(m > 0){
+    if(ubuf[fd].n + m <= UBUFSIZE){
+      // one write for the buffer and the new bytes
+      memmove(ubuf[fd].buf + ubuf[fd].n, p, m);
+      ubuf[fd].n += m;
+      if(bufflush(fd) < 0)
+        return -1;
+    } else if(bufflush(fd) < 0 || write(fd, p, m) != m)
+      return -1;
+  }
+  memmove(ubuf[fd].buf + ubuf[fd].n, p + m, n - m);
+  ubuf[fd].n += n - m;
+  return n;
+}
+
+int
+bufputc(int fd, int c)
+{
+  char ch = c;
+
+  return bufwrite(fd, &ch, 1);
+}
+
+int
+fork(void)
+{
+  bufflushall();
+  return _fork();
+}
+
+int
+exit(void)
+{
+  bufflushall();
+  _exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+  bufflushall();
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  bufflush(fd);
+  return _close(fd);
+}
@@ -1,5 +1,10 @@
 struct stat;
 struct rtcdate;
+struct iostat;
+struct iovec;
+struct pollfd;
+struct ioring;
+struct tracerec;
 #ifdef CS333_P2
 struct uproc;
 #endif // CS333_P2
@@ -49,6 +54,22 @@ int setpriority(int pid, int priority);
 int getpriority(int pid);
 #endif // CS333_P4
 
+// file system and I/O
+int iostat(int dev, struct iostat*);
+int fallocate(int fd, int off, int len);
+int fcntl(int fd, int cmd, int arg);
+int splice(int fd_in, int fd_out, int n);
+int readv(int fd, struct iovec*, int iovcnt);
+int writev(int fd, struct iovec*, int iovcnt);
+int lseek(int fd, int off, int whence);
+int pread(int fd, void*, int n, int off);
+int pwrite(int fd, void*, int n, int off);
+int poll(struct pollfd*, int n, int timeout);
+int ioring_setup(struct ioring*);
+int ioring_enter(int n);
+int trace(uint*);
+int traceread(int pid, struct tracerec*, int n);
+
 // ulib.c
 int stat(char*, struct stat*);
 char* strcpy(char*, char*);
@@ -63,3 +84,13 @@ void* malloc(uint);
 void free(void*);
 int atoi(const char*);
 int atoo(const char*);
+
+// buffered output (ulib.c); every fd starts unbuffered.
+#define BUF_NONE 0  // write at once
+#define BUF_LINE 1  // write through each newline
+#define BUF_FULL 2  // write when the buffer fills
+int bufmode(int fd, int mode);
+int bufwrite(int fd, void*, int);
+int bufputc(int fd, int c);
+int bufflush(int fd);
+void bufflushall(void);
@@ -7,6 +7,10 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "uio.h"
+#include "poll.h"
+#include "ioring.h"
+#include "trace.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +188,9 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Enough blocks to reach into the double-indirect tree.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writetest1(void)
 {
@@ -197,7 +204,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +224,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -241,6 +248,47 @@ writetest1(void)
   printf(stdout, "big files ok\n");
 }
 
+void
+fallocatetest(void)
+{
+  int fd, i, n;
+
+  printf(stdout, "fallocate test\n");
+
+  fd = open("falloc", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat falloc failed!\n");
+    exit();
+  }
+  if(fallocate(fd, 512, 512) >= 0){
+    printf(stdout, "error: fallocate past end of file succeeded\n");
+    exit();
+  }
+  if(write(fd, "x", 1) != 1 || fallocate(fd, 0, BIGBLOCKS*512) < 0){
+    printf(stdout, "error: fallocate failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("falloc", O_RDONLY);
+  for(n = 0; (i = read(fd, buf, 512)) > 0; n += i){
+    if(buf[0] != (n == 0 ? 'x' : 0) || buf[1] != 0 || buf[i-1] != 0){
+      printf(stdout, "error: fallocate left garbage at %d\n", n);
+      exit();
+    }
+  }
+  close(fd);
+  if(n != BIGBLOCKS*512){
+    printf(stdout, "error: fallocate size %d\n", n);
+    exit();
+  }
+  if(unlink("falloc") < 0){
+    printf(stdout, "unlink falloc failed\n");
+    exit();
+  }
+  printf(stdout, "fallocate test ok\n");
+}
+
 void
 createtest(void)
 {
@@ -354,6 +402,456 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// resize a pipe's buffer with fcntl, keeping what it holds
+
+void
+pipesize(void)
+{
+  int fds[2], i, n;
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  n = fcntl(fds[0], F_GETPIPE_SZ, 0);
+  if(n < 512 || fcntl(fds[0], F_SETPIPE_SZ, 5000) != 8192){
+    printf(1, "pipesize oops 1 size %d\n", n);
+    exit();
+  }
+  for(i = 0; i < 8192; i++)
+    buf[i] = i % 251;
+  // fills the new buffer exactly, so does not block
+  if(write(fds[1], buf, 8192) != 8192){
+    printf(1, "pipesize oops 2\n");
+    exit();
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 4096) >= 0 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 20000) != 32768){
+    printf(1, "pipesize oops 3\n");
+    exit();
+  }
+  memset(buf, 0, sizeof(buf));
+  if(read(fds[0], buf, sizeof(buf)) != 8192){
+    printf(1, "pipesize oops 4\n");
+    exit();
+  }
+  for(i = 0; i < 8192; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf(1, "pipesize oops 5\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(1, "pipesize ok\n");
+}
+
+// move a file through a pipe and back with splice
+
+void
+splicetest(void)
+{
+  int fds[2], in[2], out[2], fd, i, pid;
+
+  fd = open("splice", O_CREATE|O_RDWR);
+  for(i = 0; i < 3000; i++)
+    buf[i] = i % 253;
+  if(fd < 0 || write(fd, buf, 3000) != 3000){
+    printf(1, "splicetest oops 1\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  fd = open("splice", O_RDONLY);
+  if(splice(fd, fds[0], 10) >= 0 || splice(fd, fds[1], 5000) != 3000){
+    printf(1, "splicetest oops 2\n");
+    exit();
+  }
+  close(fd);
+  close(fds[1]);
+  fd = open("splice2", O_CREATE|O_RDWR);
+  if(fd < 0 || splice(fds[0], fd, 5000) != 3000){
+    printf(1, "splicetest oops 3\n");
+    exit();
+  }
+  close(fd);
+  close(fds[0]);
+  memset(buf, 0, sizeof(buf));
+  fd = open("splice2", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != 3000){
+    printf(1, "splicetest oops 4\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < 3000; i++){
+    if((buf[i] & 0xff) != i % 253){
+      printf(1, "splicetest oops 5\n");
+      exit();
+    }
+  }
+  unlink("splice");
+  unlink("splice2");
+
+  // a splice waiting on an empty pipe must not hold up
+  // other writers to its output pipe
+  if(pipe(in) != 0 || pipe(out) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(in[1]);
+    if(splice(in[0], out[1], 100) != 3)
+      printf(1, "splicetest oops 6\n");
+    exit();
+  }
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  sleep(5);
+  if(write(out[1], "x", 1) != 1 || read(out[0], buf, 1) != 1 ||
+     buf[0] != 'x'){
+    printf(1, "splicetest oops 7\n");
+    exit();
+  }
+  if(write(in[1], "abc", 3) != 3 || read(out[0], buf, 3) != 3 ||
+     buf[0] != 'a' || buf[2] != 'c'){
+    printf(1, "splicetest oops 8\n");
+    exit();
+  }
+  wait();
+  close(in[0]);
+  close(in[1]);
+  close(out[0]);
+  close(out[1]);
+  printf(1, "splicetest ok\n");
+}
+
+// write a record from several buffers and read it back
+
+void
+iovtest(void)
+{
+  struct iovec iov[3];
+  char hdr[4], tail[4];
+  int fd, i;
+
+  printf(stdout, "iov test\n");
+  fd = open("iov", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat iov failed!\n");
+    exit();
+  }
+  memmove(hdr, "HDR:", 4);
+  for(i = 0; i < 1000; i++)
+    buf[i] = i % 249;
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = 4;
+  iov[1].iov_base = buf;
+  iov[1].iov_len = 1000;
+  iov[2].iov_base = (void*)0xffffff00;  // bad segment
+  iov[2].iov_len = 1;
+  if(writev(fd, iov, 3) >= 0){
+    printf(stdout, "error: writev with bad segment succeeded\n");
+    exit();
+  }
+  if(writev(fd, iov, 0) != 0){
+    printf(stdout, "error: empty writev failed\n");
+    exit();
+  }
+  iov[2].iov_base = tail;
+  iov[2].iov_len = 0;
+  if(writev(fd, iov+2, 1) != 0){
+    printf(stdout, "error: zero-length writev failed\n");
+    exit();
+  }
+  if(writev(fd, iov, 2) != 1004){
+    printf(stdout, "error: writev failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("iov", O_RDONLY);
+  memset(hdr, 0, 4);
+  memset(buf, 0, 1000);
+  iov[2].iov_base = tail;
+  iov[2].iov_len = 4;
+  if(readv(fd, iov, 3) != 1004 || hdr[0] != 'H' || hdr[3] != ':'){
+    printf(stdout, "error: readv failed\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++){
+    if((buf[i] & 0xff) != i % 249){
+      printf(stdout, "error: readv got wrong data\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("iov");
+  printf(stdout, "iov test ok\n");
+}
+
+// positional I/O: lseek, pread and pwrite
+
+void
+seektest(void)
+{
+  int fd;
+  char c;
+
+  printf(stdout, "seek test\n");
+  fd = open("seek", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "abcdef", 6) != 6){
+    printf(stdout, "error: creat seek failed!\n");
+    exit();
+  }
+  if(lseek(fd, 1, SEEK_END) >= 0 || lseek(fd, -1, SEEK_SET) >= 0 ||
+     lseek(fd, -2, SEEK_END) != 4 || read(fd, &c, 1) != 1 || c != 'e'){
+    printf(stdout, "error: lseek failed\n");
+    exit();
+  }
+  if(pwrite(fd, "X", 1, 0) != 1 || pread(fd, &c, 1, 0) != 1 || c != 'X'){
+    printf(stdout, "error: pread/pwrite failed\n");
+    exit();
+  }
+  // the file offset is still just past the 'e'
+  if(read(fd, &c, 1) != 1 || c != 'f' || lseek(fd, 0, SEEK_CUR) != 6){
+    printf(stdout, "error: pread/pwrite moved the offset\n");
+    exit();
+  }
+  close(fd);
+  unlink("seek");
+  printf(stdout, "seek test ok\n");
+}
+
+// wait on two pipes at once with poll
+
+void
+polltest(void)
+{
+  struct pollfd pfd[2];
+  int a[2], b[2], pid;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  if(poll(pfd, 2, 0) != 0 || poll(pfd, 2, 2) != 0){
+    printf(1, "polltest oops 1\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    sleep(5);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(pid < 0 || poll(pfd, 2, -1) != 1 ||
+     pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf(1, "polltest oops 2\n");
+    exit();
+  }
+  wait();
+  close(a[1]);
+  pfd[1].fd = 100;
+  if(poll(pfd, 2, -1) != 2 || pfd[0].revents != (POLLIN|POLLHUP) ||
+     pfd[1].revents != POLLNVAL){
+    printf(1, "polltest oops 3\n");
+    exit();
+  }
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+  printf(1, "polltest ok\n");
+}
+
+// O_NONBLOCK pipes fail with -EAGAIN instead of waiting
+
+void
+nonblocktest(void)
+{
+  int fds[2], out[2], i, n, size;
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+     fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0){
+    printf(1, "nonblocktest oops 1\n");
+    exit();
+  }
+  if(read(fds[0], buf, 1) != -EAGAIN){
+    printf(1, "nonblocktest oops 2\n");
+    exit();
+  }
+  size = fcntl(fds[1], F_GETPIPE_SZ, 0);
+  for(n = 0; n < size; n += sizeof(buf))
+    if(write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+      break;
+  if(n != size || write(fds[1], buf, 1) != -EAGAIN ||
+     read(fds[0], buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "nonblocktest oops 3\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // A splice into a full non-blocking pipe leaves what does
+  // not fit in its input.
+  if(pipe(fds) != 0 || pipe(out) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++)
+    buf[i] = i % 251;
+  if(write(fds[1], buf, 6000) != 6000 ||
+     fcntl(out[1], F_SETPIPE_SZ, 4096) != 4096 ||
+     fcntl(out[1], F_SETFL, O_NONBLOCK) != 0 ||
+     splice(fds[0], out[1], 6000) != 4096 ||
+     splice(fds[0], out[1], 6000) != -EAGAIN){
+    printf(1, "nonblocktest oops 4\n");
+    exit();
+  }
+  if(read(out[0], buf, 4096) != 4096 ||
+     splice(fds[0], out[1], 6000 - 4096) != 6000 - 4096 ||
+     read(out[0], buf + 4096, 4096) != 6000 - 4096){
+    printf(1, "nonblocktest oops 5\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf(1, "nonblocktest oops 6\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(out[0]);
+  close(out[1]);
+  printf(1, "nonblocktest ok\n");
+}
+
+// batch system calls through an ioring
+
+struct ioring ring;
+
+void
+ioringtest(void)
+{
+  struct iosqe *sqe;
+  int fd, i, pid;
+
+  printf(stdout, "ioring test\n");
+  fd = open("ioring", O_CREATE|O_RDWR);
+  if(fd < 0 || ioring_setup(&ring) < 0){
+    printf(stdout, "error: ioring setup failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    sqe = &ring.sq[ring.sqtail++ % IORING_SIZE];
+    sqe->num = i < 3 ? SYS_write : SYS_fork;  // fork is refused
+    sqe->args[0] = fd;
+    sqe->args[1] = (int)"abc";
+    sqe->args[2] = 3;
+    sqe->user = i;
+  }
+  sqe = &ring.sq[ring.sqtail++ % IORING_SIZE];
+  sqe->num = SYS_getpid;
+  sqe->user = 4;
+  pid = getpid();
+  if(ioring_enter(10) != 5 || ring.sqhead != 5 || ring.cqtail != 5){
+    printf(stdout, "error: ioring_enter failed\n");
+    exit();
+  }
+  for(i = 0; i < 5; i++, ring.cqhead++){
+    if(ring.cq[i].user != i ||
+       ring.cq[i].ret != (i < 3 ? 3 : i == 3 ? -1 : pid)){
+      printf(stdout, "error: ioring completion %d wrong\n", i);
+      exit();
+    }
+  }
+  if(lseek(fd, 0, SEEK_END) != 9){
+    printf(stdout, "error: ioring writes missing\n");
+    exit();
+  }
+  close(fd);
+  unlink("ioring");
+  printf(stdout, "ioring test ok\n");
+}
+
+// getpid is traced in us, run directly or from an ioring,
+// and through fork in the child.
+void
+tracetest(void)
+{
+  static struct ioring tring;
+  struct tracerec r[4];
+  uint mask[NTRACEMASK];
+  int i, n, pid, num;
+
+  printf(stdout, "trace test\n");
+  if(ioring_setup(&tring) < 0){
+    printf(stdout, "error: ioring setup failed\n");
+    exit();
+  }
+  for(i = 0; i < NTRACEMASK; i++)
+    mask[i] = 0;
+  num = SYS_getpid;
+  mask[num/32] = 1 << num%32;
+  if(trace(mask) < 0){
+    printf(stdout, "error: trace failed\n");
+    exit();
+  }
+  pid = getpid();
+  uptime();  // not in the mask
+  if(traceread(pid, r, 4) != 1 || r[0].num != SYS_getpid || r[0].ret != pid){
+    printf(stdout, "error: trace record wrong\n");
+    exit();
+  }
+  // Calls run from an ioring are traced too.
+  tring.sq[tring.sqtail++ % IORING_SIZE].num = SYS_getpid;
+  if(ioring_enter(1) != 1 || traceread(pid, r, 4) != 1 ||
+     r[0].num != SYS_getpid || r[0].ret != pid){
+    printf(stdout, "error: ioring call not traced\n");
+    exit();
+  }
+  tring.cqhead++;
+  pid = fork();
+  if(pid == 0){
+    getpid();
+    exit();
+  }
+  mask[num/32] = 0;
+  trace(mask);
+  if(pid < 0 || traceread(getpid(), r, 4) != -1){
+    printf(stdout, "error: trace not stopped\n");
+    exit();
+  }
+  // The child's record outlives it until it is reaped.
+  n = 0;
+  while((i = traceread(pid, r+n, 4-n)) >= 0){
+    n += i;
+    if(i == 0)
+      sleep(1);
+  }
+  if(n != 1 || r[0].num != SYS_getpid || r[0].ret != pid){
+    printf(stdout, "error: child trace wrong\n");
+    exit();
+  }
+  wait();
+  printf(stdout, "trace test ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1773,6 +2271,11 @@ main(int argc, char *argv[])
   opentest();
   writetest();
   writetest1();
+  fallocatetest();
+  iovtest();
+  seektest();
+  ioringtest();
+  tracetest();
   createtest();
 
   openiputtest();
@@ -1781,6 +2284,10 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipesize();
+  splicetest();
+  polltest();
+  nonblocktest();
   preempt();
   exitwait();
 
@@ -9,6 +9,8 @@
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+extern void sysentry(void);  // in trapasm.S
+static int havesysenter;     // CPUs support sysenter
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -27,6 +29,17 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // Let user code enter the kernel with sysenter, landing at
+  // sysentry on the stack switchuvm() sets.  sysenter takes
+  // SS to be the selector after CS, and sysexit takes the two
+  // after that for user CS and SS, which the GDT order gives.
+  if(cpufeatures() & CPUID_SEP){
+    havesysenter = 1;
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+    wrmsr(MSR_SYSENTER_ESP, 0);
+  }
 }
 
 // Return the address of the PTE in page table pgdir
@@ -169,6 +182,8 @@ switchuvm(struct proc *p)
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
   mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  if(havesysenter)
+    wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
@@ -42,6 +42,7 @@ main(int argc, char *argv[])
     exit();
   }
 
+  bufmode(1, BUF_FULL);
   for(i = 1; i < argc; i++){
     if((fd = open(argv[i], 0)) < 0){
       printf(1, "wc: cannot open %s\n", argv[i]);
@@ -13,6 +13,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -34,6 +43,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -148,6 +163,31 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline unsigned long long
+rdtsc(void)
+{
+  unsigned long long val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
+static inline void
+wrmsr(uint msr, uint val)
+{
+  asm volatile("wrmsr" : : "c" (msr), "a" (val), "d" (0));
+}
+
+// Return the CPUID leaf 1 feature flags in %edx.
+static inline uint
+cpufeatures(void)
+{
+  uint eax, ebx, ecx, edx;
+
+  asm volatile("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+               : "a" (1));
+  return edx;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().